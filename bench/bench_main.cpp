@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+#include "world/match.h"
+#include "world/match_batch.h"
+#include "world/match_rules.h"
+#include "world/replay.h"
+#include "world/occupancy_grid.h"
+#include "network/match_messages.h"
+
+#ifdef TRONS_BENCH_NETWORK
+#include "network/network_manager.h"
+#endif
+
+#ifndef TRONS_BUILD_TYPE
+#define TRONS_BUILD_TYPE ""
+#endif
+
+size_t allocationCount = 0;
+const void* volatile benchSink = nullptr;
+
+void* operator new(size_t size)
+{
+    ++allocationCount;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    ++allocationCount;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+static const int gridSizes[] = { 10, 20, 40 };
+static const size_t playerCounts[] = { 2, 8, 32 };
+
+static std::string params(const char* format, ...)
+{
+    char buf[128];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    return buf;
+}
+
+// Snakes as vertical lines of length cells in spread out columns, all
+// heading forward. The board wraps, so they can run for a long time before
+// apples grow one into its own tail.
+static void startColumns(Match& match, int grid, size_t players, size_t length)
+{
+    std::vector<pos> bodies(players * length);
+    for (size_t p = 0; p < players; ++p) {
+        uint8_t x = static_cast<uint8_t>(p * grid / players);
+        for (size_t k = 0; k < length; ++k) {
+            bodies[p * length + k] = pos{ x, static_cast<uint8_t>(k) };
+        }
+    }
+    match.Start(bodies.data(), length, pos{ 0, static_cast<uint8_t>(grid - 1) });
+}
+
+static std::vector<size_t> lengthsFor(int grid)
+{
+    return { 3, static_cast<size_t>(grid / 2), static_cast<size_t>(grid - 1) };
+}
+
+static void benchNextHeads(BenchRunner& runner)
+{
+    for (int grid : gridSizes) {
+        for (size_t players : { 2, 8, 32, 64 }) {
+            SnakeTable snakes(players);
+            std::vector<pos> out(players);
+            runner.Run("next_heads", params("\"grid\":%d,\"players\":%zu", grid, players), [&](size_t iterations) {
+                for (size_t i = 0; i < iterations; ++i) {
+                    MatchRules::NextHeads(snakes.Heads(), snakes.Directions(), players, pos{ uint8_t(grid), uint8_t(grid) }, out.data());
+                    DoNotOptimize(out[0]);
+                }
+            });
+        }
+    }
+}
+
+// Ring buffer move of one snake, no board
+static void benchAdvance(BenchRunner& runner)
+{
+    for (size_t length : { 3, 50, 99 }) {
+        SnakeTable snakes(1);
+        for (size_t k = 0; k < length; ++k) {
+            snakes.AddBodyPart(0, pos{ 0, static_cast<uint8_t>(k % 40) });
+        }
+        const pos gridSize{ 40, 40 };
+        runner.Run("advance", params("\"length\":%zu", length), [&](size_t iterations) {
+            pos next;
+            pos tail;
+            for (size_t i = 0; i < iterations; ++i) {
+                MatchRules::NextHeads(snakes.Heads(), snakes.Directions(), 1, gridSize, &next);
+                DoNotOptimize(snakes.Advance(0, next, tail));
+            }
+        });
+    }
+}
+
+// Full Match::Update: moves, the collision pass over every head and apples.
+// The match is restored from a copy when it ends and every 256 ticks, which
+// is included in the time.
+static void benchTick(BenchRunner& runner)
+{
+    for (int grid : gridSizes) {
+        for (size_t players : playerCounts) {
+            if (players > static_cast<size_t>(grid)) continue;
+            for (size_t length : lengthsFor(grid)) {
+                Match match(grid, grid, players, 1);
+                startColumns(match, grid, players, length);
+                Match snapshot = match;
+                runner.Run("tick", params("\"grid\":%d,\"players\":%zu,\"length\":%zu", grid, players, length), [&](size_t iterations) {
+                    size_t sinceRestore = 0;
+                    for (size_t i = 0; i < iterations; ++i) {
+                        if (match.Update() || ++sinceRestore == 256) {
+                            match = snapshot;
+                            sinceRestore = 0;
+                        }
+                    }
+                });
+            }
+        }
+    }
+}
+
+// Apple placement on nearly full boards
+static void benchSampleFree(BenchRunner& runner)
+{
+    for (int grid : gridSizes) {
+        for (double fill : { 0.5, 0.9, 0.99, 0.999 }) {
+            OccupancyGrid occupancy(grid, grid);
+            Rng rng(1);
+            size_t cells = static_cast<size_t>(grid) * static_cast<size_t>(grid);
+            size_t keepFree = static_cast<size_t>(static_cast<double>(cells) * (1.0 - fill));
+            if (keepFree == 0) keepFree = 1;
+            pos cell;
+            while (occupancy.FreeCount() > keepFree && occupancy.SampleFree(rng, cell)) {
+                occupancy.Occupy(cell, 1);
+            }
+            runner.Run("sample_free", params("\"grid\":%d,\"fill\":%.3f", grid, fill), [&](size_t iterations) {
+                pos sampled;
+                for (size_t i = 0; i < iterations; ++i) {
+                    occupancy.SampleFree(rng, sampled);
+                    DoNotOptimize(sampled);
+                }
+            });
+        }
+    }
+}
+
+static void benchProtocol(BenchRunner& runner)
+{
+#ifdef TRONS_BENCH_NETWORK
+    NetworkManager networkManager;
+#endif
+    for (int grid : gridSizes) {
+        for (size_t players : playerCounts) {
+            if (players > static_cast<size_t>(grid)) continue;
+            for (size_t length : lengthsFor(grid)) {
+                // Snapshot 2 is one tick after snapshot 1, the usual delta
+                Match match(grid, grid, players, 1);
+                startColumns(match, grid, players, length);
+                SnapshotHistory sent;
+                const Snapshot& before = sent.Push(1, match);
+                match.Update();
+                const Snapshot& after = sent.Push(2, match);
+                std::vector<uint8_t> full;
+                std::vector<uint8_t> delta;
+                FillGameStateMsg(after, nullptr, full);
+                FillGameStateMsg(after, &before, delta);
+                std::string p = params("\"grid\":%d,\"players\":%zu,\"length\":%zu", grid, players, length);
+
+                runner.Run("encode_state", p, [&](size_t iterations) {
+                    for (size_t i = 0; i < iterations; ++i) {
+                        FillGameStateMsg(after, nullptr, full);
+                        DoNotOptimize(full[0]);
+                    }
+                }, static_cast<double>(full.size()));
+                runner.Run("encode_delta", p, [&](size_t iterations) {
+                    for (size_t i = 0; i < iterations; ++i) {
+                        FillGameStateMsg(after, &before, delta);
+                        DoNotOptimize(delta[0]);
+                    }
+                }, static_cast<double>(delta.size()));
+
+                // The client holds snapshot 1 as the delta baseline
+                Match client(grid, grid, players, 2);
+                startColumns(client, grid, players, length);
+                SnapshotHistory received;
+                std::vector<uint8_t> first;
+                FillGameStateMsg(before, nullptr, first);
+                GameStateView firstMsg;
+                firstMsg.Parse(first.data(), first.size());
+                ApplyGameStateMsg(client, firstMsg, received);
+
+                // Decoding includes the header check of the view
+                runner.Run("decode_state", p, [&](size_t iterations) {
+                    for (size_t i = 0; i < iterations; ++i) {
+                        GameStateView msg;
+                        DoNotOptimize(msg.Parse(full.data(), full.size()) && ApplyGameStateMsg(client, msg, received));
+                    }
+                }, static_cast<double>(full.size()));
+                runner.Run("decode_delta", p, [&](size_t iterations) {
+                    for (size_t i = 0; i < iterations; ++i) {
+                        GameStateView msg;
+                        DoNotOptimize(msg.Parse(delta.data(), delta.size()) && ApplyGameStateMsg(client, msg, received));
+                    }
+                }, static_cast<double>(delta.size()));
+
+#ifdef TRONS_BENCH_NETWORK
+                // Same decode behind the NetworkManager receive path, without a socket
+                networkManager.onGameStateReceive = [&](const GameStateView& msg) {
+                    ApplyGameStateMsg(client, msg, received);
+                };
+                runner.Run("dispatch_state", p, [&](size_t iterations) {
+                    for (size_t i = 0; i < iterations; ++i) {
+                        networkManager.Dispatch(0, delta.data(), delta.size());
+                    }
+                }, static_cast<double>(delta.size()));
+#endif
+            }
+        }
+    }
+}
+
+// Plays every batch match next to Match(grid, grid, players, seed + index)
+// on the same random inputs, restarting both when they finish. Snakes,
+// apple, result, tick and rewards have to agree after every step.
+static bool checkBatch(int grid, size_t players, uint64_t seed)
+{
+    const size_t matchCount = 32;
+    const size_t steps = 2000;
+    MatchBatch batch(matchCount, players, grid, grid, seed);
+    std::vector<Match> matches;
+    for (size_t m = 0; m < matchCount; ++m) {
+        matches.emplace_back(grid, grid, players, seed + m);
+        matches.back().Start();
+    }
+    std::vector<uint8_t> inputs(matchCount * players);
+    std::vector<uint8_t> wasAlive(players);
+    pos batchBody[maxSnakeSize];
+    pos matchBody[maxSnakeSize];
+    Rng rng(seed ^ 0x5EED);
+
+    for (size_t step = 0; step < steps; ++step) {
+        for (auto& input : inputs) {
+            uint32_t r = rng.Below(8);
+            input = r < 4 ? static_cast<uint8_t>(r) : MatchBatch::noInput;
+        }
+        batch.StepAll(inputs.data());
+
+        const SnakeTable& batchSnakes = batch.GetSnakes();
+        for (size_t m = 0; m < matchCount; ++m) {
+            Match& match = matches[m];
+            const SnakeTable& snakes = match.GetSnakes();
+            bool active = match.GetState() == GameState::Active;
+            pos apple = match.GetApplePosition();
+            bool applePlaced = match.IsApplePlaced();
+            for (size_t p = 0; p < players; ++p) {
+                wasAlive[p] = snakes.IsAlive(p);
+                if (inputs[m * players + p] != MatchBatch::noInput) {
+                    match.SetDirection(p, static_cast<Direction>(inputs[m * players + p]));
+                }
+            }
+            bool finished = match.Update();
+
+            bool same = batch.IsTerminal(m) == (match.GetState() != GameState::Active) &&
+                batch.GetTick(m) == match.GetTick() && batch.GetApplePosition(m) == match.GetApplePosition() &&
+                batch.GetResult(m).winner == match.GetResult().winner;
+            for (size_t p = 0; same && p < players; ++p) {
+                size_t slot = m * players + p;
+                BodyView body = snakes.GetBody(p);
+                BodyView batchView = batchSnakes.GetBody(slot);
+                same = body.size() == batchView.size() && snakes.IsAlive(p) == batchSnakes.IsAlive(slot) &&
+                    snakes.GetDirection(p) == batchSnakes.GetDirection(slot);
+                if (same) {
+                    body.CopyTo(matchBody);
+                    batchView.CopyTo(batchBody);
+                    same = std::equal(matchBody, matchBody + body.size(), batchBody);
+                }
+
+                float reward = 0.0f;
+                if (active) {
+                    if (wasAlive[p] && !snakes.IsAlive(p)) reward += MatchBatch::deathReward;
+                    if (!finished && applePlaced && snakes.IsAlive(p) && snakes.GetHead(p) == apple) reward += MatchBatch::appleReward;
+                    if (finished && match.GetResult().winner == p) reward += MatchBatch::winReward;
+                }
+                same = same && batch.GetRewards()[slot] == reward;
+            }
+            if (!same) {
+                std::fprintf(stderr, "batch match %zu of %dx%d, %zu players, seed %llu differs from Match on step %zu, tick %u\n",
+                    m, grid, grid, players, static_cast<unsigned long long>(seed), step, match.GetTick());
+                return false;
+            }
+
+            if (batch.IsTerminal(m)) {
+                batch.Reset(m);
+                match.Start();
+            }
+        }
+    }
+    return true;
+}
+
+// One op is a StepAll over every match of the batch, with random inputs.
+// Finished matches are reset inside the timed loop. False if the batch
+// does not play like Match, the numbers would be for other rules then.
+static bool benchBatch(BenchRunner& runner)
+{
+    const size_t matchCount = 1024;
+    for (int grid : { 20, 40 }) {
+        for (size_t players : { 2, 8 }) {
+            if (runner.Enabled("batch_step") && !checkBatch(grid, players, 1)) {
+                return false;
+            }
+            MatchBatch batch(matchCount, players, grid, grid, 1);
+            std::vector<uint8_t> inputs(matchCount * players);
+            Rng rng(2);
+            runner.Run("batch_step", params("\"grid\":%d,\"players\":%zu,\"matches\":%zu", grid, players, matchCount), [&](size_t iterations) {
+                for (size_t i = 0; i < iterations; ++i) {
+                    for (auto& input : inputs) {
+                        uint32_t r = rng.Below(8);
+                        input = r < 4 ? static_cast<uint8_t>(r) : MatchBatch::noInput;
+                    }
+                    batch.StepAll(inputs.data());
+                    if (batch.GetTerminalCount() > matchCount / 4) {
+                        for (size_t m = 0; m < matchCount; ++m) {
+                            if (batch.IsTerminal(m)) batch.Reset(m);
+                        }
+                    }
+                }
+            });
+        }
+    }
+    return true;
+}
+
+// Headless playback of a recorded match at full speed, one op is one tick.
+// Playback restarts from the first keyframe at the end of the recording.
+// False if the replay can not be read or plays out to another winner.
+// expectedWinner is a player index, GameResult::noWinner to take any result
+static bool benchReplay(BenchRunner& runner, const char* path, uint8_t expectedWinner)
+{
+    ReplayReader reader;
+    if (!reader.Open(path)) {
+        std::fprintf(stderr, "could not open replay %s\n", path);
+        return false;
+    }
+    const ReplayHeader& header = reader.GetHeader();
+    Match match(header.gridSizeX, header.gridSizeZ, header.playerCount, 0);
+
+    // The recorded result and length have to come out of the playback,
+    // otherwise the numbers are for a different game
+    if (!reader.IsComplete()) {
+        std::fprintf(stderr, "replay %s was cut short, it has no result to check\n", path);
+        return false;
+    }
+    reader.Seek(match, 0);
+    while (reader.Step(match)) {}
+    GameResult recorded = reader.GetResult();
+    if (recorded.winner != match.GetResult().winner || reader.GetTickCount() != match.GetTick()) {
+        std::fprintf(stderr, "replay %s diverged: recorded winner %d after %llu ticks, playback winner %d after %u\n", path,
+            recorded.winner, static_cast<unsigned long long>(reader.GetTickCount()), match.GetResult().winner, match.GetTick());
+        return false;
+    }
+    if (expectedWinner != GameResult::noWinner && recorded.winner != expectedWinner) {
+        std::fprintf(stderr, "replay %s: winner %d, expected %d\n", path, recorded.winner, expectedWinner);
+        return false;
+    }
+    if (reader.GetTickCount() == 0) {
+        return true;
+    }
+
+    std::string p = params("\"grid\":%d,\"players\":%d,\"ticks\":%llu", header.gridSizeX, header.playerCount,
+        static_cast<unsigned long long>(reader.GetTickCount()));
+    reader.Seek(match, 0);
+    runner.Run("replay_playback", p, [&](size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            if (!reader.Step(match)) {
+                reader.Seek(match, 0);
+            }
+        }
+    });
+
+    Rng rng(3);
+    uint32_t ticks = static_cast<uint32_t>(reader.GetTickCount());
+    runner.Run("replay_seek", p, [&](size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            DoNotOptimize(reader.Seek(match, rng.Below(ticks + 1)));
+        }
+    });
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const char* filter = nullptr;
+    double minTimeMs = 200.0;
+    const char* replayPath = nullptr;
+    uint8_t expectedWinner = GameResult::noWinner;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            minTimeMs = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--expect-winner") == 0 && i + 1 < argc) {
+            expectedWinner = static_cast<uint8_t>(std::atoi(argv[++i]));
+        }
+        else {
+            std::fprintf(stderr, "usage: trons-bench [--filter NAME] [--min-time MS] [--replay FILE [--expect-winner N]]\n");
+            return 1;
+        }
+    }
+
+    BenchRunner runner(filter, minTimeMs, TRONS_BUILD_TYPE);
+    benchNextHeads(runner);
+    benchAdvance(runner);
+    benchTick(runner);
+    benchSampleFree(runner);
+    benchProtocol(runner);
+    if (!benchBatch(runner)) {
+        return 2;
+    }
+    if (replayPath && !benchReplay(runner, replayPath, expectedWinner)) {
+        return 2;
+    }
+    return 0;
+}
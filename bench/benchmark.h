@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Heap allocations so far, counted by the operator new replacement in bench_main.cpp
+extern size_t allocationCount;
+extern const void* volatile benchSink;
+
+// Forces value to be materialized, so the work that produced it is not optimized out
+template <class T>
+inline void DoNotOptimize(const T& value)
+{
+    benchSink = &value;
+}
+
+// Runs each benchmark for at least minTimeMs and prints one JSON object per
+// line, so runs can be diffed or loaded by a script. params is a JSON
+// fragment without braces, e.g. "grid":20,"players":2.
+class BenchRunner {
+public:
+    BenchRunner(const char* filter, double minTimeMs, const char* buildType) :
+        filter(filter), minTimeMs(minTimeMs), buildType(buildType) {}
+
+    // fn(iterations) runs iterations operations. bytesPerOp adds a data rate
+    // to the output for encoders and decoders.
+    // False if the filter leaves the benchmark out
+    bool Enabled(const char* name) const { return !filter || std::strstr(name, filter); }
+
+    template <class Fn>
+    void Run(const char* name, const std::string& params, Fn&& fn, double bytesPerOp = 0.0)
+    {
+        if (!Enabled(name)) {
+            return;
+        }
+
+        // Warm up caches and let lazily sized buffers settle
+        fn(static_cast<size_t>(16));
+
+        size_t iterations = 16;
+        double elapsedNs = 0.0;
+        size_t allocations = 0;
+        while (true) {
+            size_t allocationsBefore = allocationCount;
+            auto start = std::chrono::steady_clock::now();
+            fn(iterations);
+            auto end = std::chrono::steady_clock::now();
+            allocations = allocationCount - allocationsBefore;
+            elapsedNs = std::chrono::duration<double, std::nano>(end - start).count();
+            if (elapsedNs >= minTimeMs * 1e6 || iterations >= (static_cast<size_t>(1) << 40)) {
+                break;
+            }
+            // Aim a little past the minimum so most cases finish on the next round
+            double scale = elapsedNs > 0.0 ? (minTimeMs * 1e6 * 1.2) / elapsedNs : 100.0;
+            if (scale > 100.0) scale = 100.0;
+            if (scale < 2.0) scale = 2.0;
+            iterations = static_cast<size_t>(static_cast<double>(iterations) * scale);
+        }
+
+        double nsPerOp = elapsedNs / static_cast<double>(iterations);
+        std::printf("{\"bench\":\"%s\",%s,\"iterations\":%zu,\"ns_per_op\":%.3f,\"allocs_per_op\":%.4f,\"ops_per_sec\":%.1f",
+            name, params.c_str(), iterations, nsPerOp,
+            static_cast<double>(allocations) / static_cast<double>(iterations), 1e9 / nsPerOp);
+        if (bytesPerOp > 0.0) {
+            std::printf(",\"bytes_per_op\":%.1f,\"mb_per_sec\":%.2f", bytesPerOp, bytesPerOp * 1e3 / nsPerOp);
+        }
+        std::printf(",\"build\":\"%s\"}\n", buildType);
+        std::fflush(stdout);
+    }
+
+private:
+    const char* filter;
+    double minTimeMs;
+    const char* buildType;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "misc/rng.h"
+
+// What the network does to packets on the way, per direction
+struct LinkProfile
+{
+    const char* name;
+    double latencyMs;
+    // Each packet is delayed by latency plus or minus up to jitter
+    double jitterMs;
+    double loss;
+    double duplicate;
+    // Chance a packet is held back long enough for later ones to pass it
+    double reorder;
+};
+
+// One direction of a connection on a simulated clock, seeded so a run can
+// be repeated exactly. Unreliable packets are lost, duplicated and reordered
+// as the profile says. Reliable ones behave like ENet's reliable channel:
+// a lost one is resent a retransmit timeout later, and none is delivered
+// before the ones sent ahead of it.
+class ImpairedLink {
+public:
+    struct Packet
+    {
+        double deliverAt;
+        uint64_t order;
+        double sentAt;
+        bool reliable;
+        std::vector<uint8_t> data;
+    };
+
+    ImpairedLink(const LinkProfile& profile, uint64_t seed) : profile(profile), rng(seed) {}
+
+    void Send(double now, const uint8_t* data, size_t size, bool reliable)
+    {
+        ++packetsSent;
+        bytesSent += size;
+        if (reliable) {
+            double at = now + delay();
+            while (chance() < profile.loss) {
+                ++resends;
+                bytesSent += size;
+                at += retransmitTimeout();
+            }
+            at = std::max(at, lastReliableAt);
+            lastReliableAt = at;
+            push(at, now, true, data, size);
+            return;
+        }
+        if (chance() < profile.loss) {
+            ++packetsLost;
+        }
+        else {
+            push(now + delay(), now, false, data, size);
+        }
+        if (chance() < profile.duplicate) {
+            ++duplicates;
+            push(now + delay(), now, false, data, size);
+        }
+    }
+
+    // Takes the next packet due by now, false if none is
+    bool Receive(double now, Packet& packet)
+    {
+        if (queue.empty() || queue.front().deliverAt > now) {
+            return false;
+        }
+        std::pop_heap(queue.begin(), queue.end(), later);
+        packet = std::move(queue.back());
+        queue.pop_back();
+        return true;
+    }
+
+    void Clear()
+    {
+        queue.clear();
+        lastReliableAt = 0.0;
+    }
+
+    uint64_t packetsSent = 0;
+    // Payload only, resends included
+    uint64_t bytesSent = 0;
+    uint64_t packetsLost = 0;
+    uint64_t duplicates = 0;
+    uint64_t resends = 0;
+
+private:
+    static bool later(const Packet& a, const Packet& b)
+    {
+        return a.deliverAt != b.deliverAt ? a.deliverAt > b.deliverAt : a.order > b.order;
+    }
+
+    double chance() { return rng.Next() * (1.0 / 4294967296.0); }
+
+    double delay()
+    {
+        double d = profile.latencyMs + (chance() * 2.0 - 1.0) * profile.jitterMs;
+        if (chance() < profile.reorder) {
+            d += profile.latencyMs + profile.jitterMs + 1.0;
+        }
+        return std::max(d, 0.0);
+    }
+
+    // ENet waits about a round trip plus four times its variation
+    double retransmitTimeout() const { return std::max(2.0 * profile.latencyMs + 4.0 * profile.jitterMs, 1.0); }
+
+    void push(double at, double now, bool reliable, const uint8_t* data, size_t size)
+    {
+        queue.push_back(Packet{ at, nextOrder++, now, reliable, std::vector<uint8_t>(data, data + size) });
+        std::push_heap(queue.begin(), queue.end(), later);
+    }
+
+    LinkProfile profile;
+    Rng rng;
+    std::vector<Packet> queue;
+    uint64_t nextOrder = 0;
+    double lastReliableAt = 0.0;
+};
@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "impaired_link.h"
+
+#include "world/match.h"
+#include "world/match_rules.h"
+#include "network/match_messages.h"
+#include "network/match_sync.h"
+
+// trons-netsim: a server and its clients in one process, joined by impaired
+// links on a simulated clock, so nothing touches a socket and a seed always
+// gives the same run. The server and the clients run the MatchSender and
+// MatchReceiver of Room and Game; bots make the turns.
+
+static const LinkProfile profiles[] = {
+    { "clean", 0.0, 0.0, 0.0, 0.0, 0.0 },
+    { "lan", 2.0, 1.0, 0.0, 0.0, 0.0 },
+    { "wan", 40.0, 10.0, 0.01, 0.0, 0.01 },
+    { "mobile", 80.0, 30.0, 0.05, 0.01, 0.05 },
+    { "bad", 150.0, 60.0, 0.15, 0.05, 0.1 },
+};
+
+struct NetSimConfig
+{
+    LinkProfile link;
+    size_t clients = 2;
+    int grid = 20;
+    double seconds = 120.0;
+    uint64_t seed = 1;
+    // Chance a bot turns on a tick
+    double turnChance = 0.25;
+};
+
+class Samples {
+public:
+    void Add(double value) { values.push_back(value); }
+    size_t Count() const { return values.size(); }
+
+    double Mean() const
+    {
+        double sum = 0.0;
+        for (double v : values) sum += v;
+        return values.empty() ? 0.0 : sum / values.size();
+    }
+
+    double Percentile(double p) const
+    {
+        if (values.empty()) return 0.0;
+        std::vector<double> sorted = values;
+        size_t at = std::min(static_cast<size_t>(p * sorted.size()), sorted.size() - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + at, sorted.end());
+        return sorted[at];
+    }
+
+    double Max() const { return values.empty() ? 0.0 : *std::max_element(values.begin(), values.end()); }
+
+private:
+    std::vector<double> values;
+};
+
+struct NetSimReport
+{
+    uint64_t matches = 0;
+    // From a server tick to the client applying its state
+    Samples tickDelay;
+    // From a client turn to the server applying it
+    Samples inputDelay;
+    // Turns the server got after their tick had run
+    uint64_t lateInputs = 0;
+    uint64_t downBytes = 0;
+    uint64_t upBytes = 0;
+    uint64_t statesApplied = 0;
+    // Arrived after a newer one
+    uint64_t statesStale = 0;
+    // Could not be decoded, their baseline was gone
+    uint64_t statesRejected = 0;
+    // Decoded to something other than what the server sent
+    uint64_t desyncs = 0;
+    uint64_t mispredictions = 0;
+    uint64_t resyncs = 0;
+};
+
+class NetSim {
+public:
+    static constexpr int restartDelayTicks = 4;
+    // Server snapshots kept to check what the clients decode
+    static constexpr size_t sentCapacity = 256;
+
+    explicit NetSim(const NetSimConfig& config);
+    NetSimReport Run();
+
+private:
+    struct Client
+    {
+        Client(const NetSimConfig& config, uint64_t seed);
+
+        Match match;
+        MatchReceiver receiver;
+        ImpairedLink down;
+        ImpairedLink up;
+        Rng bot;
+        std::vector<uint8_t> buffer;
+    };
+
+    struct PendingInput
+    {
+        double sentAt;
+        uint32_t tick;
+    };
+
+    void serverReceive(size_t slot);
+    void serverTick();
+    void startMatch();
+    void sendStates(bool final);
+    void clientReceive(Client& client);
+    void clientTick(Client& client);
+    void applyState(Client& client, const ImpairedLink::Packet& packet);
+
+    NetSimConfig config;
+    double now = 0.0;
+    Match match;
+    MatchSender sender;
+    std::vector<std::vector<PendingInput>> pending;
+    std::vector<Snapshot> sent;
+    std::vector<uint8_t> buffer;
+    int restartCountdown = 0;
+    Rng rng;
+    std::vector<std::unique_ptr<Client>> clients;
+    NetSimReport report;
+};
+
+NetSim::Client::Client(const NetSimConfig& config, uint64_t seed) :
+    match(config.grid, config.grid, config.clients),
+    down(config.link, seed * 3 + 1),
+    up(config.link, seed * 3 + 2),
+    bot(seed * 3 + 3)
+{
+}
+
+NetSim::NetSim(const NetSimConfig& config) :
+    config(config),
+    match(config.grid, config.grid, config.clients),
+    sender(config.clients),
+    pending(config.clients),
+    sent(sentCapacity),
+    rng(config.seed)
+{
+    for (size_t i = 0; i < config.clients; ++i) {
+        clients.push_back(std::make_unique<Client>(config, config.seed * 64 + i));
+    }
+}
+
+NetSimReport NetSim::Run()
+{
+    // Clients tick out of phase with the server and each other, like real ones
+    std::vector<double> clientTickAt(clients.size());
+    for (size_t i = 0; i < clients.size(); ++i) {
+        clientTickAt[i] = tickIntervalMs * (i + 1.0) / (clients.size() + 1.0);
+    }
+    double serverTickAt = 0.0;
+
+    for (now = 0.0; now < config.seconds * 1000.0; now += 1.0) {
+        for (size_t i = 0; i < clients.size(); ++i) {
+            serverReceive(i);
+        }
+        if (now >= serverTickAt) {
+            serverTick();
+            serverTickAt += tickIntervalMs;
+        }
+        for (size_t i = 0; i < clients.size(); ++i) {
+            clientReceive(*clients[i]);
+            if (now >= clientTickAt[i]) {
+                clientTick(*clients[i]);
+                clientTickAt[i] += tickIntervalMs;
+            }
+        }
+    }
+
+    for (auto& client : clients) {
+        report.downBytes += client->down.bytesSent;
+        report.upBytes += client->up.bytesSent;
+        const PredictionStats& stats = client->receiver.GetPrediction().GetStats();
+        report.mispredictions += stats.mispredictions;
+        report.resyncs += stats.resyncs;
+    }
+    return report;
+}
+
+void NetSim::serverReceive(size_t slot)
+{
+    ImpairedLink::Packet packet;
+    while (clients[slot]->up.Receive(now, packet)) {
+        MessageType type;
+        uint8_t version;
+        if (!PeekMessageHeader(packet.data.data(), packet.data.size(), type, version)) continue;
+        if (type == MessageType::SnakeDirChange) {
+            SnakeDirChangeView msg;
+            if (!msg.Parse(packet.data.data(), packet.data.size()) || match.GetState() != GameState::Active) continue;
+            sender.OnSnakeDirChange(match, slot, msg);
+            pending[slot].push_back(PendingInput{ packet.sentAt, msg.Tick() });
+        }
+        else if (type == MessageType::SnapshotAck) {
+            SnapshotAckView msg;
+            if (!msg.Parse(packet.data.data(), packet.data.size())) continue;
+            sender.OnSnapshotAck(slot, msg);
+        }
+    }
+}
+
+void NetSim::serverTick()
+{
+    if (match.GetState() == GameState::Active) {
+        // The turns MatchSender::ApplyInputs is about to make
+        for (auto& list : pending) {
+            for (size_t k = 0; k < list.size();) {
+                if (list[k].tick > match.GetTick()) {
+                    ++k;
+                    continue;
+                }
+                report.inputDelay.Add(now - list[k].sentAt);
+                if (list[k].tick < match.GetTick()) ++report.lateInputs;
+                list.erase(list.begin() + k);
+            }
+        }
+        sender.ApplyInputs(match);
+        bool finished = match.Update();
+        sendStates(finished);
+        if (finished) {
+            StopGameMsg msg;
+            msg.result = match.GetResult();
+            EncodeStopGame(msg, buffer);
+            for (auto& client : clients) {
+                client->down.Send(now, buffer.data(), buffer.size(), true);
+            }
+            restartCountdown = restartDelayTicks;
+        }
+        return;
+    }
+    if (restartCountdown > 0) {
+        --restartCountdown;
+        return;
+    }
+    startMatch();
+}
+
+void NetSim::startMatch()
+{
+    match.Seed((static_cast<uint64_t>(rng.Next()) << 32) | rng.Next());
+    if (!match.Start()) {
+        std::fprintf(stderr, "The board is too small for %zu players\n", clients.size());
+        std::exit(1);
+    }
+    sender.Start();
+    for (auto& list : pending) {
+        list.clear();
+    }
+
+    FillStartGameMsg(match, 0, buffer);
+    for (size_t i = 0; i < clients.size(); ++i) {
+        SetStartGamePlayerId(buffer, static_cast<uint8_t>(i));
+        clients[i]->down.Send(now, buffer.data(), buffer.size(), true);
+    }
+    ++report.matches;
+}
+
+void NetSim::sendStates(bool final)
+{
+    const Snapshot& current = sender.PushState(match);
+    sent[current.sequence % sentCapacity] = current;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        const std::vector<uint8_t>& state = sender.StateFor(i);
+        clients[i]->down.Send(now, state.data(), state.size(), final);
+    }
+}
+
+void NetSim::clientReceive(Client& client)
+{
+    ImpairedLink::Packet packet;
+    while (client.down.Receive(now, packet)) {
+        MessageType type;
+        uint8_t version;
+        if (!PeekMessageHeader(packet.data.data(), packet.data.size(), type, version)) continue;
+        if (type == MessageType::StartGame) {
+            StartGameView msg;
+            if (!msg.Parse(packet.data.data(), packet.data.size()) || !client.receiver.OnStartGame(client.match, msg, true)) {
+                std::fprintf(stderr, "invalid StartGameMsg\n");
+            }
+        }
+        else if (type == MessageType::GameState) {
+            applyState(client, packet);
+        }
+        else if (type == MessageType::StopGame) {
+            StopGameView msg;
+            if (!msg.Parse(packet.data.data(), packet.data.size())) continue;
+            client.match.Pause();
+            client.receiver.Stop();
+        }
+    }
+}
+
+void NetSim::applyState(Client& client, const ImpairedLink::Packet& packet)
+{
+    GameStateView msg;
+    if (!msg.Parse(packet.data.data(), packet.data.size())) return;
+    // The link's own round trip stands in for ENet's estimate
+    uint32_t rtt = static_cast<uint32_t>(2.0 * config.link.latencyMs);
+    MatchReceiver::StateResult applied = client.receiver.OnGameState(client.match, msg, rtt);
+    if (applied == MatchReceiver::StateResult::Stale) {
+        ++report.statesStale;
+        return;
+    }
+    if (applied == MatchReceiver::StateResult::Invalid) {
+        ++report.statesRejected;
+        return;
+    }
+    ++report.statesApplied;
+    report.tickDelay.Add(now - packet.sentAt);
+    const Snapshot& expected = sent[msg.Sequence() % sentCapacity];
+    if (expected.sequence == msg.Sequence() &&
+        (!SameState(expected, client.match) || expected.apple != client.match.GetApplePosition())) {
+        ++report.desyncs;
+    }
+
+    EncodeSnapshotAck(client.receiver.GetAck(), client.buffer);
+    client.up.Send(now, client.buffer.data(), client.buffer.size(), false);
+}
+
+void NetSim::clientTick(Client& client)
+{
+    if (!client.receiver.IsPredicting()) return;
+    Prediction& prediction = client.receiver.GetPrediction();
+    if (client.bot.Next() * (1.0 / 4294967296.0) < config.turnChance) {
+        SnakeDirChangeMsg msg;
+        msg.direction = static_cast<Direction>(client.bot.Below(4));
+        msg.tick = prediction.AddInput(msg.direction);
+        EncodeSnakeDirChange(msg, client.buffer);
+        client.up.Send(now, client.buffer.data(), client.buffer.size(), true);
+    }
+    prediction.Step();
+}
+
+static void printReport(const NetSimConfig& config, const NetSimReport& report)
+{
+    double seconds = config.seconds;
+    std::printf("{\"netsim\":\"%s\",\"latency_ms\":%.1f,\"jitter_ms\":%.1f,\"loss\":%.3f,\"duplicate\":%.3f,\"reorder\":%.3f,"
+        "\"clients\":%zu,\"grid\":%d,\"seconds\":%.0f,\"seed\":%llu,\"matches\":%llu,",
+        config.link.name, config.link.latencyMs, config.link.jitterMs, config.link.loss, config.link.duplicate, config.link.reorder,
+        config.clients, config.grid, seconds, static_cast<unsigned long long>(config.seed), static_cast<unsigned long long>(report.matches));
+    std::printf("\"tick_delay_mean_ms\":%.1f,\"tick_delay_p95_ms\":%.1f,\"tick_delay_max_ms\":%.1f,",
+        report.tickDelay.Mean(), report.tickDelay.Percentile(0.95), report.tickDelay.Max());
+    std::printf("\"input_delay_mean_ms\":%.1f,\"input_delay_p95_ms\":%.1f,\"input_delay_max_ms\":%.1f,\"inputs\":%zu,\"late_inputs\":%llu,",
+        report.inputDelay.Mean(), report.inputDelay.Percentile(0.95), report.inputDelay.Max(), report.inputDelay.Count(),
+        static_cast<unsigned long long>(report.lateInputs));
+    std::printf("\"down_bytes_per_sec\":%.1f,\"up_bytes_per_sec\":%.1f,",
+        report.downBytes / seconds / config.clients, report.upBytes / seconds / config.clients);
+    std::printf("\"states_applied\":%llu,\"states_stale\":%llu,\"states_rejected\":%llu,\"desyncs\":%llu,\"mispredictions\":%llu,\"resyncs\":%llu}\n",
+        static_cast<unsigned long long>(report.statesApplied), static_cast<unsigned long long>(report.statesStale),
+        static_cast<unsigned long long>(report.statesRejected), static_cast<unsigned long long>(report.desyncs),
+        static_cast<unsigned long long>(report.mispredictions), static_cast<unsigned long long>(report.resyncs));
+    std::fflush(stdout);
+}
+
+static int usage()
+{
+    std::fprintf(stderr, "usage: trons-netsim [--profile NAME] [--latency MS] [--jitter MS] [--loss P] [--duplicate P] [--reorder P]\n"
+        "                    [--clients N] [--grid N] [--seconds S] [--seed N]\n");
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    NetSimConfig config;
+    const char* profile = nullptr;
+    // Link options left negative keep the profile's value
+    LinkProfile custom = { "custom", -1.0, -1.0, -1.0, -1.0, -1.0 };
+    bool useCustom = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            custom.latencyMs = std::atof(argv[++i]);
+            useCustom = true;
+        }
+        else if (std::strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) {
+            custom.jitterMs = std::atof(argv[++i]);
+            useCustom = true;
+        }
+        else if (std::strcmp(argv[i], "--loss") == 0 && i + 1 < argc) {
+            custom.loss = std::atof(argv[++i]);
+            useCustom = true;
+        }
+        else if (std::strcmp(argv[i], "--duplicate") == 0 && i + 1 < argc) {
+            custom.duplicate = std::atof(argv[++i]);
+            useCustom = true;
+        }
+        else if (std::strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            custom.reorder = std::atof(argv[++i]);
+            useCustom = true;
+        }
+        else if (std::strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            config.clients = static_cast<size_t>(std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            config.grid = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            config.seconds = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            config.seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else {
+            return usage();
+        }
+    }
+    // Same limits as trons-server
+    if (config.grid < 4 || config.grid > maxfieldSizeX || config.grid > maxfieldSizeZ) {
+        std::fprintf(stderr, "grid must be 4 to %d\n", maxfieldSizeX);
+        return usage();
+    }
+    size_t capacity = std::min(MatchRules::SpawnCapacity(config.grid, config.grid), static_cast<size_t>(maxPlayers));
+    if (config.clients < 1 || config.clients > capacity || config.seconds <= 0.0) {
+        std::fprintf(stderr, "clients must be 1 to %zu on a %dx%d board, seconds above 0\n", capacity, config.grid, config.grid);
+        return usage();
+    }
+
+    // Without a profile or link options every profile runs; link options
+    // change the named profile, or a clean link
+    std::vector<LinkProfile> links;
+    for (const LinkProfile& link : profiles) {
+        if (profile ? std::strcmp(profile, link.name) == 0 : !useCustom) links.push_back(link);
+    }
+    if (profile && links.empty()) {
+        std::fprintf(stderr, "unknown profile %s\n", profile);
+        return 1;
+    }
+    if (useCustom) {
+        LinkProfile link = links.empty() ? profiles[0] : links[0];
+        link.name = "custom";
+        if (custom.latencyMs >= 0.0) link.latencyMs = custom.latencyMs;
+        if (custom.jitterMs >= 0.0) link.jitterMs = custom.jitterMs;
+        if (custom.loss >= 0.0) link.loss = custom.loss;
+        if (custom.duplicate >= 0.0) link.duplicate = custom.duplicate;
+        if (custom.reorder >= 0.0) link.reorder = custom.reorder;
+        links.assign(1, link);
+    }
+
+    // A desync is a protocol bug, so it fails the run
+    uint64_t desyncs = 0;
+    double cleanInputDelay = -1.0;
+    double lanInputDelay = -1.0;
+    for (const LinkProfile& link : links) {
+        config.link = link;
+        NetSimReport report = NetSim(config).Run();
+        printReport(config, report);
+        desyncs += report.desyncs;
+        if (std::strcmp(link.name, "clean") == 0) cleanInputDelay = report.inputDelay.Mean();
+        if (std::strcmp(link.name, "lan") == 0) lanInputDelay = report.inputDelay.Mean();
+    }
+    // A link of a few milliseconds must not cost the turns a tick, as a
+    // prediction running too far ahead would
+    bool leadTooLong = cleanInputDelay >= 0.0 && lanInputDelay > cleanInputDelay + tickIntervalMs;
+    if (leadTooLong) {
+        std::fprintf(stderr, "lan input delay %.1f ms is more than a tick above clean %.1f ms\n", lanInputDelay, cleanInputDelay);
+    }
+    return desyncs == 0 && !leadTooLong ? 0 : 2;
+}
@@ -1,5 +1,10 @@
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <thread>
+#include <vector>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -18,19 +23,29 @@
 
 #include "world/game.h"
 #include "shaders/shader.h"
+#include "shaders/uniform_buffer.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void cursor_pos_callback(GLFWwindow* window, double x, double y);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
+void scroll_callback(GLFWwindow* window, double x, double y);
+void char_callback(GLFWwindow* window, unsigned int codepoint);
+void window_refresh_callback(GLFWwindow* window);
 
 inline void init_gl_buffers();
+inline void init_cube_vao(unsigned int vao, unsigned int instanceBuffer);
+inline void bake_board(const pos& grid);
 inline void init_glfw_window();
 inline void init_shader();
+inline void update_frame_uniforms();
 
 inline void render_game();
 inline void render_main_menu();
 inline void render_lobby();
 inline void render_client_connection_info();
 inline void render_game_over();
+inline void render_network_stats();
 inline void render_preloader();
 inline void render_server_game_params();
 
@@ -55,15 +70,47 @@ GLFWwindow* window = nullptr;
 
 Shader shader;
 unsigned int VBO, VAO;
+UniformBuffer frame_uniforms;
+
+// Every cube is one instance of the same mesh, the moving ones of a frame
+// are drawn with a single call
+struct CubeInstance
+{
+    glm::vec3 offset;
+    glm::vec3 scale;
+    glm::vec3 color;
+};
+unsigned int instanceVBO;
+size_t instance_capacity = 0;
+std::vector<CubeInstance> cube_instances;
+// Floor and border only change with the grid size, they are kept in their
+// own buffer and rebuilt when it does
+unsigned int boardVAO, boardInstanceVBO;
+GLsizei board_instance_count = 0;
+pos baked_grid_size{ 0, 0 };
 
 bool isServer = false;
+// Join a dedicated server's match as a spectator
+bool spectate = false;
+// F3 shows the network stats over the game
+bool show_network_stats = false;
+
+// Frames of the match are paced by vsync and the optional cap. The menus
+// wait for input instead, and are only drawn for a few frames after
+// something changed.
+bool vsync = defaultVsync;
+int frame_cap = defaultFrameCap;
+int redraw_frames = 0;
+
+inline void request_redraw()
+{
+    redraw_frames = uiSettleFrames;
+}
 
 char game_buf[sizeof(Game)];
 char address_buf[20];
 char port_buf[6];
 
-float deltaTime = 0.0f;
-float lastFrame = 0.0f;
 
 int current_width = SCR_WIDTH;
 int current_height = SCR_HEIGHT;
@@ -96,10 +143,25 @@ int main(int argc, char** argv)
 
     State = RenderState::MAIN_MENU;
 
+    // TronS [--replay FILE] [--no-vsync] [--fps-cap N]
+    const char* replay_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--no-vsync") == 0) {
+            vsync = false;
+        }
+        else if (std::strcmp(argv[i], "--fps-cap") == 0 && i + 1 < argc) {
+            frame_cap = std::max(std::atoi(argv[++i]), 0);
+        }
+    }
+
     init_glfw_window();
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         return -1;
     }
+    Shader::loadBinaryFunctions((GLADloadproc)glfwGetProcAddress);
 
     init_gl_buffers();
 
@@ -111,12 +173,53 @@ int main(int argc, char** argv)
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330");
 
+    // A replay skips the menus
+    if (replay_path) {
+        new (game_buf) Game(current_field_sizeX, current_field_sizeX);
+        gamePtr = reinterpret_cast<Game*>(game_buf);
+        init_shader();
+        gamePtr->onGameOver = on_game_over_cb;
+        if (gamePtr->StartReplay(replay_path)) {
+            State = RenderState::GAME_ACTIVE;
+        }
+        else {
+            std::cerr << "could not open replay " << replay_path << std::endl;
+        }
+    }
+
     glEnable(GL_DEPTH_TEST);
     glClearColor(clearColor.x, clearColor.y, clearColor.z, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    RenderState drawn_state = State;
+    request_redraw();
+    auto next_frame = std::chrono::steady_clock::now();
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+        bool playing = State == RenderState::GAME_ACTIVE;
+        if (playing) {
+            glfwPollEvents();
+        }
+        else {
+            // Input ends the wait early, otherwise it ends in time to
+            // dispatch what the network thread received
+            glfwWaitEventsTimeout(idleWakeupSeconds);
+        }
+        if (State != drawn_state) {
+            drawn_state = State;
+            request_redraw();
+        }
+
+        // The preloader animates, every other menu stays as last drawn
+        if (!playing && State != RenderState::CONNECTING_PRELOADER && redraw_frames == 0) {
+            if (gamePtr && (State == RenderState::LOBBY || State == RenderState::GAME_OVER)) {
+                gamePtr->Update();
+            }
+            continue;
+        }
+        if (redraw_frames > 0) {
+            --redraw_frames;
+        }
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         switch (State)
@@ -137,33 +240,27 @@ int main(int argc, char** argv)
             case CONNECTING_PRELOADER:
             {
                 render_preloader();
-                float currentFrame = static_cast<float>(glfwGetTime());
-                deltaTime = currentFrame - lastFrame;
-                lastFrame = currentFrame;
-                gamePtr->Update(deltaTime);
+                gamePtr->Update();
                 break;
             }
             case LOBBY:
             { 
                 render_lobby();
-                float currentFrame = static_cast<float>(glfwGetTime());
-                deltaTime = currentFrame - lastFrame;
-                lastFrame = currentFrame;
-                gamePtr->Update(deltaTime);
+                gamePtr->Update();
                 break;
             }
             case GAME_ACTIVE:
             { 
-                float currentFrame = static_cast<float>(glfwGetTime());
-                deltaTime = currentFrame - lastFrame;
-                lastFrame = currentFrame;
-                gamePtr->Update(deltaTime);
+                gamePtr->Update();
 
                 if (gamePtr->getState() != GameState::Active && !lastRender) {
                     break;
                 }
 
                 render_game();
+                if (show_network_stats && gamePtr->IsNetworked()) {
+                    render_network_stats();
+                }
 
                 break;
             }
@@ -171,10 +268,7 @@ int main(int argc, char** argv)
             {
                 render_game_over();
 
-                float currentFrame = static_cast<float>(glfwGetTime());
-                deltaTime = currentFrame - lastFrame;
-                lastFrame = currentFrame;
-                gamePtr->Update(deltaTime);
+                gamePtr->Update();
 
                 break; 
             }
@@ -185,10 +279,25 @@ int main(int argc, char** argv)
         }
 
         glfwSwapBuffers(window);
+
+        if (playing && frame_cap > 0) {
+            next_frame += std::chrono::nanoseconds(1000000000 / frame_cap);
+            auto now = std::chrono::steady_clock::now();
+            // After a slow frame the cap starts over rather than catching up
+            if (next_frame < now) {
+                next_frame = now;
+            }
+            else {
+                std::this_thread::sleep_until(next_frame);
+            }
+        }
     }
 
     glDeleteVertexArrays(1, &VAO);
+    glDeleteVertexArrays(1, &boardVAO);
     glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &instanceVBO);
+    glDeleteBuffers(1, &boardInstanceVBO);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -208,29 +317,132 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     current_width = width;
     current_height = height;
     glViewport(0, 0, width, height);
+    request_redraw();
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-    if (action == GLFW_PRESS) {
-        gamePtr->ProcessInput(key);
+    request_redraw();
+    if (action != GLFW_PRESS || !gamePtr) {
+        return;
     }
+    switch (key) {
+        case GLFW_KEY_W:
+        case GLFW_KEY_UP:
+            gamePtr->ProcessInput(Direction::FORWARD);
+            break;
+        case GLFW_KEY_S:
+        case GLFW_KEY_DOWN:
+            gamePtr->ProcessInput(Direction::BACKWARD);
+            break;
+        case GLFW_KEY_A:
+        case GLFW_KEY_LEFT:
+            gamePtr->ProcessInput(Direction::LEFT);
+            break;
+        case GLFW_KEY_D:
+        case GLFW_KEY_RIGHT:
+            gamePtr->ProcessInput(Direction::RIGHT);
+            break;
+        case GLFW_KEY_F3:
+            show_network_stats = !show_network_stats;
+            break;
+        default: break;
+    }
+}
+
+// Input of any kind redraws the menus
+void cursor_pos_callback(GLFWwindow* window, double x, double y)
+{
+    request_redraw();
+}
+
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+    request_redraw();
+}
+
+void scroll_callback(GLFWwindow* window, double x, double y)
+{
+    request_redraw();
+}
+
+void char_callback(GLFWwindow* window, unsigned int codepoint)
+{
+    request_redraw();
+}
+
+void window_refresh_callback(GLFWwindow* window)
+{
+    request_redraw();
 }
 
 inline void init_gl_buffers()
 {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
+    frame_uniforms.create(sizeof(FrameUniforms), frameUniformBinding);
 
-    glBindVertexArray(VAO);
+    glGenBuffers(1, &VBO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
-    
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &instanceVBO);
+    init_cube_vao(VAO, instanceVBO);
+
+    glGenVertexArrays(1, &boardVAO);
+    glGenBuffers(1, &boardInstanceVBO);
+    init_cube_vao(boardVAO, boardInstanceVBO);
+}
+
+// The cube mesh with one set of instances
+inline void init_cube_vao(unsigned int vao, unsigned int instanceBuffer)
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
     
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
+
+    // Offset, scale and color advance once per cube
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (unsigned int i = 0; i < 3; ++i) {
+        glVertexAttribPointer(2 + i, 3, GL_FLOAT, GL_FALSE, sizeof(CubeInstance), (void*)(i * sizeof(glm::vec3)));
+        glEnableVertexAttribArray(2 + i);
+        glVertexAttribDivisor(2 + i, 1);
+    }
+}
+
+inline void bake_board(const pos& grid)
+{
+    std::vector<CubeInstance> board;
+    glm::vec2 gridSize(grid.x, grid.z);
+    for (int x = -1; x <= gridSize.x; x += static_cast<int>(gridSize.y + 1)) {
+        for (int z = -1; z <= gridSize.y; z += static_cast<int>(gridSize.y + 1)) {
+            board.push_back({ glm::vec3(x, 0.0f, z), glm::vec3(0.5f, 3.0f, 0.5f), borderColor });
+        }
+    }
+
+    for (int x = -1; x <= gridSize.x; x += static_cast<int>(gridSize.x + 1)) {
+        board.push_back({ glm::vec3(x, 0.0f, (gridSize.y - 1) / 2.0f), glm::vec3(0.25f, 0.25f, gridSize.y + 1.0f), borderColor });
+    }
+
+    for (int z = -1; z <= gridSize.y; z += static_cast<int>(gridSize.y + 1)) {
+        board.push_back({ glm::vec3((gridSize.x - 1) / 2.0f, 0.0f, z), glm::vec3(gridSize.x + 1.0f, 0.25f, 0.25f), borderColor });
+    }
+
+    for (int i = 0; i < gridSize.x; ++i) {
+        for (int j = 0; j < gridSize.y; ++j) {
+            float diff = float(i + j) * 0.04f;
+            board.push_back({ glm::vec3(i, -1.0f, j), glm::vec3(1.0f), glm::vec3(diff, diff, diff) });
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, boardInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, board.size() * sizeof(CubeInstance), board.data(), GL_STATIC_DRAW);
+    board_instance_count = static_cast<GLsizei>(board.size());
+    baked_grid_size = grid;
 }
 
 inline void init_glfw_window() 
@@ -248,103 +460,128 @@ inline void init_glfw_window()
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetKeyCallback(window, key_callback);
+    // Set before ImGui installs its own, which call these in turn
+    glfwSetCursorPosCallback(window, cursor_pos_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetScrollCallback(window, scroll_callback);
+    glfwSetCharCallback(window, char_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+    glfwSwapInterval(vsync ? 1 : 0);
 }
 
 inline void init_shader()
 {
+    // Every match start calls this, the program is only built once
+    if (shader.isLoaded()) {
+        return;
+    }
     std::filesystem::path _path = std::filesystem::current_path();
     std::string current_path = _path.string();
     std::string vetex_shader_path = current_path + vertex_shader_filename;
     std::string fragment_shader_path = current_path + fragment_shader_filename;
 
-    shader.setVertex(vetex_shader_path.c_str());
-    shader.setFragment(fragment_shader_path.c_str());
-    shader.linkProgram();
+    if (!shader.loadProgram(vetex_shader_path.c_str(), fragment_shader_path.c_str(), current_path + shader_cache_dirname)) {
+        std::cerr << "could not build the shader program" << std::endl;
+        return;
+    }
     shader.use();
 
-    shader.setVec3("lightPos", lightPos);
-    shader.setVec3("lightColor", lightColor);
-    shader.setVec3("viewPos", gamePtr->GetCamera().GetPosition());
-    float aspect = static_cast<float>(SCR_WIDTH) / static_cast<float>(SCR_HEIGHT);
-    glm::mat4 projection = gamePtr->GetCamera().GetProjectionMatrix(aspect);
-    glm::mat4 view = gamePtr->GetCamera().GetViewMatrix();
-    shader.setMat4("projection", projection);
-    shader.setMat4("view", view);
+    if (!shader.bindUniformBlock("Frame", frame_uniforms.getBinding())) {
+        std::cerr << "the shaders have no Frame uniform block" << std::endl;
+    }
+    else if (shader.uniformBlockSize("Frame") != static_cast<GLint>(sizeof(FrameUniforms))) {
+        std::cerr << "the Frame uniform block does not match FrameUniforms" << std::endl;
+    }
+}
+
+// Camera and light for the frame, the camera may have moved and the
+// window may have been resized since the last one
+inline void update_frame_uniforms()
+{
+    const Camera& camera = gamePtr->GetCamera();
+    float frame_aspect = current_height > 0 ? static_cast<float>(current_width) / static_cast<float>(current_height) : aspect;
+    FrameUniforms frame;
+    frame.view = camera.GetViewMatrix();
+    frame.projection = camera.GetProjectionMatrix(frame_aspect);
+    frame.lightPos = glm::vec4(lightPos, 1.0f);
+    frame.lightColor = glm::vec4(lightColor, 1.0f);
+    frame.viewPos = glm::vec4(camera.GetPosition(), 1.0f);
+    frame_uniforms.update(&frame);
 }
 
 inline void render_game()
 {
     shader.use();
-
-    shader.setVec3("objectColor", snake1Color);
-    for (const auto& _part : gamePtr->GetSnake().GetBodyParts()) {
-        glm::vec3 part(_part.x, 0.0f, _part.y);
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, part);
-        model = glm::scale(model, glm::vec3(0.9f));
-        shader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-    }
-
-    shader.setVec3("objectColor", snake2Color);
-    for (const auto& _part : gamePtr->GetSnake2().GetBodyParts()) {
-        glm::mat4 model = glm::mat4(1.0f);
-        glm::vec3 part(_part.x, 0.0f, _part.y);
-        model = glm::translate(model, part);
-        model = glm::scale(model, glm::vec3(0.9f));
-        shader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-    }
-
-    shader.setVec3("objectColor", appleColor);
-    glm::mat4 model = glm::mat4(1.0f);
-    glm::vec2 xy_pos = gamePtr->GetApplePosition();
-    glm::vec3 part(xy_pos.x, 0.0f, xy_pos.y);
-    model = glm::translate(model, part);
-    model = glm::scale(model, glm::vec3(0.9f));
-    shader.setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-
-    shader.setVec3("objectColor", borderColor);
-    glm::vec2 gridSize = gamePtr->GetGridSize();
-    for (int x = -1; x <= gridSize.x; x += static_cast<int>(gridSize.y + 1)) {
-        for (int z = -1; z <= gridSize.y; z += static_cast<int>(gridSize.y + 1)) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(x, 0.0f, z));
-            model = glm::scale(model, glm::vec3(0.5f, 3.0f, 0.5f));
-            shader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+    update_frame_uniforms();
+    cube_instances.clear();
+
+    const SnakeTable& snakes = gamePtr->GetSnakes();
+    const InterpolatedSnakes& bodies = gamePtr->GetRenderSnakes();
+    for (size_t i = 0; i + 1 < bodies.offsets.size() && i < snakes.Count(); ++i) {
+        glm::vec3 color = snakePalette[i % snakePaletteSize];
+        if (!snakes.IsAlive(i)) {
+            color = color * deadSnakeShade;
+        }
+        for (size_t j = bodies.offsets[i]; j < bodies.offsets[i + 1]; ++j) {
+            cube_instances.push_back({ glm::vec3(bodies.cells[j].x, 0.0f, bodies.cells[j].z), glm::vec3(0.9f), color });
         }
     }
 
-    for (int x = -1; x <= gridSize.x; x += static_cast<int>(gridSize.x + 1)) {
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(x, 0.0f, (gridSize.y - 1) / 2.0f));
-        model = glm::scale(model, glm::vec3(0.25f, 0.25f, gridSize.y + 1.0f));
-        shader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+    pos apple_pos = gamePtr->GetApplePosition();
+    cube_instances.push_back({ glm::vec3(apple_pos.x, 0.0f, apple_pos.z), glm::vec3(0.9f), appleColor });
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    // The buffer only grows, a frame with fewer cubes overwrites its front
+    if (cube_instances.size() > instance_capacity) {
+        instance_capacity = cube_instances.size() * 2;
+        glBufferData(GL_ARRAY_BUFFER, instance_capacity * sizeof(CubeInstance), nullptr, GL_DYNAMIC_DRAW);
     }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, cube_instances.size() * sizeof(CubeInstance), cube_instances.data());
 
-    for (int z = -1; z <= gridSize.y; z += static_cast<int>(gridSize.y + 1)) {
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3((gridSize.x - 1) / 2.0f, 0.0f, z));
-        model = glm::scale(model, glm::vec3(gridSize.x + 1.0f, 0.25f, 0.25f));
-        shader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+    glBindVertexArray(VAO);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, static_cast<GLsizei>(cube_instances.size()));
+
+    // A new match or a replay may have changed the grid
+    if (gamePtr->GetGridSize() != baked_grid_size) {
+        bake_board(gamePtr->GetGridSize());
     }
+    glBindVertexArray(boardVAO);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, board_instance_count);
+}
 
-    for (int i = 0; i < gridSize.x; ++i) {
-        for (int j = 0; j < gridSize.y; ++j) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(i, -1.0f, j));
-            model = glm::scale(model, glm::vec3(1.0f));
-            shader.setMat4("model", model);
-            float diff = float(i + j) * 0.04f;
-            glm::vec3 current_color(diff, diff, diff);
-            shader.setVec3("objectColor", current_color);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-        }
+inline void render_network_stats()
+{
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+
+    ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_Always);
+    ImGui::SetNextWindowBgAlpha(0.6f);
+    ImGui::Begin("Network", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav);
+
+    NetworkStats stats = gamePtr->GetNetworkStats();
+    for (const PeerStats& peer : stats.peers) {
+        ImGui::Text("Peer %u: rtt %u ms +- %u, loss %.1f%%", peer.peerId, peer.roundTripTimeMs, peer.roundTripTimeVarianceMs, peer.packetLoss * 100.0);
+        ImGui::Text("  out %.0f B/s %.1f pkt/s, in %.0f B/s %.1f pkt/s", peer.sent.bytesPerSecond, peer.sent.packetsPerSecond, peer.received.bytesPerSecond, peer.received.packetsPerSecond);
+        ImGui::Text("  reliable in flight %zu, retransmits %llu", peer.reliableInFlight, static_cast<unsigned long long>(peer.retransmits));
+    }
+    ImGui::Separator();
+    for (size_t i = 0; i < messageTypeCount; ++i) {
+        if (stats.sent[i].packets == 0 && stats.received[i].packets == 0) continue;
+        ImGui::Text("%-15s out %6.0f B/s, in %6.0f B/s, dropped %llu", MessageTypeName(static_cast<MessageType>(i)),
+            stats.sent[i].bytesPerSecond, stats.received[i].bytesPerSecond, static_cast<unsigned long long>(stats.dropped[i]));
     }
+    ImGui::Text("Send queue %zu, receive queue %zu", stats.sendQueueDepth, stats.receiveQueueDepth);
+    ImGui::Text("Interpolation delay %lld ms", static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(gamePtr->GetInterpolationDelay()).count()));
+    const PredictionStats& prediction = gamePtr->GetPredictionStats();
+    if (prediction.predictedTicks > 0) {
+        ImGui::Text("Mispredictions %llu, resyncs %llu, mean depth %.1f", static_cast<unsigned long long>(prediction.mispredictions),
+            static_cast<unsigned long long>(prediction.resyncs), prediction.MeanCorrectionDepth());
+    }
+
+    ImGui::End();
+    ImGui::Render();
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
 inline void render_main_menu()
@@ -442,6 +679,7 @@ inline void render_client_connection_info()
     ImGui::InputText("##ip_address", address_buf, IM_ARRAYSIZE(address_buf));
     ImGui::Spacing();
     ImGui::InputText("##port", port_buf, IM_ARRAYSIZE(port_buf));
+    ImGui::Checkbox("Spectate", &spectate);
 
     ImGui::Spacing();
 
@@ -636,17 +874,17 @@ inline void render_lobby()
 inline void render_game_over()
 {
     std::string result;
-    if(current_result == GameResult::Tie)
+    if(current_result.IsTie())
     {
         result = "It's Tie!";
     }
-    else if(current_result == GameResult::Snake1)
+    else if(!gamePtr->IsReplaying() && current_result.winner == gamePtr->GetLocalPlayer())
     {
-        result = "Player1 Win!";
+        result = "You Win!";
     }
     else 
     {
-        result = "Player2 Win!";
+        result = "Player" + std::to_string(current_result.winner + 1) + " Win!";
     }
 
     ImGui_ImplOpenGL3_NewFrame();
@@ -713,7 +951,8 @@ inline void render_game_over()
 inline void render_preloader()
 {
     static float loadingProgress = 0.0f;
-    static float loadingSpeed = 0.0001f; 
+    // Per second, the preloader is drawn at the idle wake-up rate
+    static float loadingSpeed = 0.1f;
 
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -753,7 +992,7 @@ inline void render_preloader()
 
     ImGui::Spacing();
 
-    loadingProgress += loadingSpeed;
+    loadingProgress += loadingSpeed * ImGui::GetIO().DeltaTime;
     if (loadingProgress > 1.0f) loadingProgress = 0.0f;
 
     ImGui::ProgressBar(loadingProgress, ImVec2(button_width, button_height), NULL);
@@ -818,7 +1057,7 @@ void client_connection_info_start_cb()
 {
     int port;
     sscanf_s(port_buf, "%d", &port);
-    gamePtr->initializeClient(port, address_buf);
+    gamePtr->initializeClient(port, address_buf, spectate);
     gamePtr->onConnected = on_connected_cb;
     gamePtr->onDisconnected = on_disconnected_cb;
     gamePtr->onGameOver = on_game_over_cb;
@@ -836,12 +1075,14 @@ void lobby_start_cb()
 
 void on_connected_cb()
 {
+    request_redraw();
     player2.isConnected = true;
     State = RenderState::LOBBY;
 }
 
 void on_disconnected_cb()
 {
+    request_redraw();
     player2.isConnected = false;
     if(!isServer)
     {
@@ -4,15 +4,40 @@ constexpr unsigned int SCR_WIDTH = 1280;
 constexpr unsigned int SCR_HEIGHT = 720;
 
 constexpr glm::vec3 clearColor(66.0f / 255.0f, 209.0f / 255.0f, 266.0f / 255.0f);
-constexpr glm::vec3 snake1Color(0.0f, 1.0f, 0.0f);  // Green for player 1
-constexpr glm::vec3 snake2Color(0.0f, 0.0f, 1.0f);  // Blue for player 2
+// Snake colors by player index, repeated when there are more players
+constexpr glm::vec3 snakePalette[] = {
+    glm::vec3(0.0f, 1.0f, 0.0f),  // Green for player 1
+    glm::vec3(0.0f, 0.0f, 1.0f),  // Blue for player 2
+    glm::vec3(1.0f, 1.0f, 0.0f),
+    glm::vec3(1.0f, 0.0f, 1.0f),
+    glm::vec3(0.0f, 1.0f, 1.0f),
+    glm::vec3(1.0f, 0.5f, 0.0f),
+    glm::vec3(0.6f, 0.3f, 1.0f),
+    glm::vec3(1.0f, 1.0f, 1.0f),
+};
+constexpr size_t snakePaletteSize = sizeof(snakePalette) / sizeof(snakePalette[0]);
+constexpr float deadSnakeShade = 0.35f;
 constexpr glm::vec3 appleColor(1.0f, 0.0f, 0.0f);
 constexpr glm::vec3 borderColor(0.5f, 0.5f, 0.5f);
 constexpr glm::vec3 lightPos(5.0f, 10.0f, 5.0f);
 constexpr glm::vec3 lightColor(1.0f, 1.0f, 1.0f);
 
+// Gameplay frame pacing, TronS --no-vsync and --fps-cap N override it.
+// A cap of 0 leaves the frame rate to vsync.
+constexpr bool defaultVsync = true;
+constexpr int defaultFrameCap = 0;
+// Menus with nothing to draw still wake up this often for the network
+constexpr double idleWakeupSeconds = 0.05;
+// ImGui takes a couple of frames to settle hover and focus after an input
+constexpr int uiSettleFrames = 3;
+
+// Binding point of the per-frame uniform buffer
+constexpr unsigned int frameUniformBinding = 0;
+
 constexpr const char* vertex_shader_filename = "\\vertex.glsl";
 constexpr const char* fragment_shader_filename = "\\fragment.glsl";
+// Linked shader programs, reused by later launches
+constexpr const char* shader_cache_dirname = "\\shader_cache";
 
 constexpr float cubeVertices[] = {
     // positions          // normals
@@ -66,12 +91,14 @@ constexpr float cubeVertices[] = {
 constexpr int maxfieldSizeX = 40;
 constexpr int maxfieldSizeZ = 40;
 constexpr int maxSnakeSize = 99;
+constexpr int maxPlayers = 64;
+constexpr int tickIntervalMs = 250;
 
 #endif // GAME_PREF
 
 #ifdef NETWORK_PREF
 
-    constexpr char* default_address = "127.0.0.1";
-    constexpr char* default_port = "12345";
+    constexpr const char* default_address = "127.0.0.1";
+    constexpr const char* default_port = "12345";
 
 #endif // NETWORK_PREF
\ No newline at end of file
@@ -1,11 +1,25 @@
 #pragma once
 
+#include <cstdint>
 
-enum class GameResult : uint8_t
+// Board cell, used by the simulation and sent as is on the wire
+struct pos
 {
-    Tie,
-    Snake1,
-    Snake2
+    uint8_t x;
+    uint8_t z;
+
+    bool operator==(const pos& other) const { return x == other.x && z == other.z; }
+    bool operator!=(const pos& other) const { return !(*this == other); }
+};
+
+// Index of the last snake standing, or noWinner for a tie
+struct GameResult
+{
+    static constexpr uint8_t noWinner = UINT8_MAX;
+
+    uint8_t winner = noWinner;
+
+    bool IsTie() const { return winner == noWinner; }
 };
 
 enum class GameState : uint8_t
@@ -1,6 +0,0 @@
-#include "game_utils.h"
-#define GAME_PREF
-#include "game_preferences.h"
-
-LUT<uint8_t, float> u8_f(0, 45);
-LUT<float, uint8_t> f_u8(0.0f, 45.0f);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+// Small seeded generator (xorshift64*). Eight bytes of state, so a match can
+// be copied or kept by the thousand, and the state can be saved and restored.
+class Rng {
+public:
+    explicit Rng(uint64_t seed = 0) { Seed(seed); }
+
+    void Seed(uint64_t seed)
+    {
+        // SplitMix64 step, spreads small seeds and never leaves a zero state
+        uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        state = (z ^ (z >> 31)) | 1;
+    }
+
+    uint32_t Next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return static_cast<uint32_t>((state * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+
+    // Uniform in [0, bound), bound must not be 0. Multiply-shift with
+    // rejection of the biased low range.
+    uint32_t Below(uint32_t bound)
+    {
+        uint64_t m = static_cast<uint64_t>(Next()) * bound;
+        uint32_t low = static_cast<uint32_t>(m);
+        if (low < bound) {
+            uint32_t threshold = (0u - bound) % bound;
+            while (low < threshold) {
+                m = static_cast<uint64_t>(Next()) * bound;
+                low = static_cast<uint32_t>(m);
+            }
+        }
+        return static_cast<uint32_t>(m >> 32);
+    }
+
+    uint64_t GetState() const { return state; }
+    void SetState(uint64_t s) { state = s; }
+
+private:
+    uint64_t state;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded ring for exactly one producer and one consumer thread, no locks.
+// Slots are filled and read in place, so large entries are never copied:
+// the producer writes into BeginPush() and commits it with EndPush(), the
+// consumer reads Front() and releases it with Pop(). Committed entries only
+// become visible to the consumer with Publish(), so a batch is handed over
+// at once.
+template <typename T>
+class SpscQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) { Reserve(capacity); }
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer: the next free slot, nullptr while the queue is full
+    T* BeginPush()
+    {
+        size_t t = stagedTail;
+        if (t - cachedHead > mask) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t - cachedHead > mask) return nullptr;
+        }
+        return &slots[t & mask];
+    }
+    void EndPush() { ++stagedTail; }
+    void Publish() { tail.store(stagedTail, std::memory_order_release); }
+    // Entries committed but not yet published
+    size_t Staged() const { return stagedTail - tail.load(std::memory_order_relaxed); }
+
+    // Consumer: the oldest entry, nullptr while the queue is empty
+    T* Front()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h == cachedTail) return nullptr;
+        }
+        return &slots[h & mask];
+    }
+    void Pop() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Approximate from any thread
+    size_t Size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    size_t Capacity() const { return mask + 1; }
+
+    // Drops every entry, only while neither side is in use
+    void Clear()
+    {
+        tail.store(stagedTail, std::memory_order_relaxed);
+        head.store(stagedTail, std::memory_order_relaxed);
+        cachedHead = cachedTail = stagedTail;
+    }
+
+    // Grows the ring to at least capacity and empties it, only while
+    // neither side is in use
+    void Reserve(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        if (size > mask + 1 || !slots) {
+            slots.reset(new T[size]);
+            mask = size - 1;
+        }
+        Clear();
+    }
+
+private:
+    std::unique_ptr<T[]> slots;
+    size_t mask = 0;
+    // Each side keeps a stale copy of the other's index and only reloads it
+    // when the ring looks full or empty
+    alignas(64) std::atomic<size_t> head{ 0 };
+    size_t cachedTail = 0;
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    size_t stagedTail = 0;
+    size_t cachedHead = 0;
+};
@@ -0,0 +1,46 @@
+#include "tick_scheduler.h"
+
+TickScheduler::TickScheduler(std::chrono::nanoseconds interval, uint32_t maxCatchUp) :
+    interval(interval), maxCatchUp(maxCatchUp)
+{
+    Reset();
+}
+
+void TickScheduler::Reset(Clock::time_point now)
+{
+    last = now;
+    lastDue = now;
+    advanced = 0;
+    accumulator = std::chrono::nanoseconds(0);
+    tick = 0;
+    stats = TickStats{};
+}
+
+uint32_t TickScheduler::Advance(Clock::time_point now)
+{
+    if (now > last) {
+        accumulator += now - last;
+        last = now;
+    }
+
+    uint32_t due = 0;
+    while (accumulator >= interval) {
+        accumulator -= interval;
+        if (due == maxCatchUp) {
+            ++stats.droppedTicks;
+            continue;
+        }
+        ++due;
+        ++tick;
+
+        // What is left in the accumulator is how long ago this tick was due
+        int64_t late = accumulator.count();
+        lastDue = last - accumulator;
+        ++stats.ticks;
+        stats.totalLateNs += late;
+        stats.lastLateNs = late;
+        if (late > stats.maxLateNs) stats.maxLateNs = late;
+    }
+    advanced = due;
+    return due;
+}
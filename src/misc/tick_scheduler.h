@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Lateness of the ticks run since the last ResetStats, measured from the
+// time each tick was due
+struct TickStats
+{
+    uint64_t ticks = 0;
+    // Ticks skipped because the caller fell more than maxCatchUp ticks behind
+    uint64_t droppedTicks = 0;
+    int64_t totalLateNs = 0;
+    int64_t maxLateNs = 0;
+    int64_t lastLateNs = 0;
+
+    int64_t MeanLateNs() const { return ticks > 0 ? totalLateNs / static_cast<int64_t>(ticks) : 0; }
+};
+
+// Fixed-step scheduler on the monotonic clock. Elapsed time goes into an
+// integer nanosecond accumulator and whatever is left after the due steps
+// carries over, so the tick rate does not drift with the frame rate or with
+// uptime. Every step has a tick number.
+class TickScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TickScheduler(std::chrono::nanoseconds interval = std::chrono::milliseconds(250), uint32_t maxCatchUp = 4);
+
+    // Starts counting from now, the first tick is due one interval later
+    void Reset(Clock::time_point now = Clock::now());
+
+    // Returns how many ticks are due at now and counts them as run. After a
+    // stall of more than maxCatchUp ticks the rest of the backlog is dropped.
+    uint32_t Advance(Clock::time_point now = Clock::now());
+
+    // Number of ticks run since Reset
+    uint64_t GetTick() const { return tick; }
+    // When tick step of the ones the last Advance returned was due, from 0.
+    // Ticks run back to back to catch up keep their own times.
+    Clock::time_point DueTime(uint32_t step) const { return lastDue - (advanced - 1 - step) * interval; }
+    Clock::time_point NextTickTime() const { return last + (interval - accumulator); }
+    std::chrono::nanoseconds GetInterval() const { return interval; }
+    // Fraction of the current interval that has passed, for interpolation
+    float GetAlpha() const { return static_cast<float>(accumulator.count()) / static_cast<float>(interval.count()); }
+
+    const TickStats& GetStats() const { return stats; }
+    void ResetStats() { stats = TickStats{}; }
+
+private:
+    std::chrono::nanoseconds interval;
+    std::chrono::nanoseconds accumulator{ 0 };
+    Clock::time_point last;
+    Clock::time_point lastDue;
+    uint32_t advanced = 0;
+    uint64_t tick = 0;
+    uint32_t maxCatchUp;
+    TickStats stats;
+};
@@ -0,0 +1,383 @@
+#include "match_messages.h"
+#include <cstring>
+
+void FillStartGameMsg(const Match& match, uint8_t playerId, std::vector<uint8_t>& buffer)
+{
+    const SnakeTable& snakes = match.GetSnakes();
+    size_t count = snakes.Count();
+    size_t bodySize = count > 0 ? snakes.GetLength(0) : 0;
+
+    wire::PutHeader(buffer, MessageType::StartGame);
+    wire::PutU8(buffer, match.GetGridSize().x);
+    wire::PutU8(buffer, match.GetGridSize().z);
+    wire::PutU8(buffer, playerId);
+    wire::PutU8(buffer, static_cast<uint8_t>(count));
+    wire::PutU8(buffer, static_cast<uint8_t>(bodySize));
+    wire::PutU8(buffer, match.GetApplePosition().x);
+    wire::PutU8(buffer, match.GetApplePosition().z);
+
+    // Every snake has the spawn length when the message is built
+    size_t at = buffer.size();
+    buffer.resize(at + count * bodySize * sizeof(pos));
+    pos* bodies = reinterpret_cast<pos*>(buffer.data() + at);
+    for (size_t i = 0; i < count; ++i) {
+        snakes.GetBody(i).CopyTo(bodies + i * bodySize);
+    }
+}
+
+void SetStartGamePlayerId(std::vector<uint8_t>& buffer, uint8_t playerId)
+{
+    // After the header and the grid size, see StartGameView
+    buffer[messageHeaderSize + 2] = playerId;
+}
+
+// Snake records of a game state message. The first byte holds the direction in
+// bits 0-1, alive in bit 2 and the record kind in bits 4-5:
+//   unchanged  same body as in the baseline
+//   advanced   length, count n, then n steps from the baseline head to the
+//              new head; the rest of the body is the front of the baseline
+//   chain      length, head cell, then length - 1 steps towards the tail
+//   cells      length, then every cell, for a body that is not connected
+// A step is 2 bits, four to a byte: +x, -x, +z or -z on the wrapping board.
+// A snake that moved one cell costs 4 bytes instead of its whole body.
+enum RecordKind : uint8_t {
+    unchangedRecord,
+    advancedRecord,
+    chainRecord,
+    cellsRecord,
+};
+
+static int stepCode(const pos& from, const pos& to, const pos& grid)
+{
+    if (from.z == to.z) {
+        if (to.x == (from.x + 1) % grid.x) return 0;
+        if (from.x == (to.x + 1) % grid.x) return 1;
+    }
+    else if (from.x == to.x) {
+        if (to.z == (from.z + 1) % grid.z) return 2;
+        if (from.z == (to.z + 1) % grid.z) return 3;
+    }
+    return -1;
+}
+
+static pos applyStep(const pos& from, uint8_t code, const pos& grid)
+{
+    switch (code) {
+        case 0: return pos{ static_cast<uint8_t>((from.x + 1) % grid.x), from.z };
+        case 1: return pos{ static_cast<uint8_t>((from.x + grid.x - 1) % grid.x), from.z };
+        case 2: return pos{ from.x, static_cast<uint8_t>((from.z + 1) % grid.z) };
+        default: return pos{ from.x, static_cast<uint8_t>((from.z + grid.z - 1) % grid.z) };
+    }
+}
+
+// Steps along path[0], path[1], ... path[count]. False if two cells are not neighbours.
+static bool appendSteps(std::vector<uint8_t>& out, const pos* path, size_t count, const pos& grid)
+{
+    size_t at = out.size();
+    out.resize(at + (count + 3) / 4, 0);
+    for (size_t i = 0; i < count; ++i) {
+        int code = stepCode(path[i], path[i + 1], grid);
+        if (code < 0) return false;
+        out[at + i / 4] |= static_cast<uint8_t>(code << ((i % 4) * 2));
+    }
+    return true;
+}
+
+static void appendCell(std::vector<uint8_t>& out, const pos& cell)
+{
+    out.push_back(cell.x);
+    out.push_back(cell.z);
+}
+
+static bool encodeAdvanced(std::vector<uint8_t>& out, uint8_t flags, const pos* body, size_t length, const SnakeStateEntry& base, const pos* baseBody, const pos& grid)
+{
+    if (base.body_sz == 0) return false;
+    for (size_t k = 0; k < length; ++k) {
+        // body[k..] has to be the front of the baseline body
+        if (length - k > base.body_sz || std::memcmp(body + k, baseBody, (length - k) * sizeof(pos)) != 0) {
+            continue;
+        }
+        if (k == 0 && length == base.body_sz) {
+            out.push_back(flags | (unchangedRecord << 4));
+            return true;
+        }
+
+        size_t start = out.size();
+        out.push_back(flags | (advancedRecord << 4));
+        out.push_back(static_cast<uint8_t>(length));
+        out.push_back(static_cast<uint8_t>(k));
+        pos path[maxSnakeSize];
+        for (size_t i = 0; i <= k; ++i) {
+            path[i] = body[k - i];
+        }
+        if (appendSteps(out, path, k, grid)) return true;
+        out.resize(start);
+        return false;
+    }
+    return false;
+}
+
+static void encodeSnake(std::vector<uint8_t>& out, const Snapshot& current, const Snapshot* baseline, size_t player, bool headOnly)
+{
+    const SnakeStateEntry& entry = current.snakes[player];
+    const pos* body = current.Body(player);
+    size_t length = headOnly && entry.body_sz > 0 ? 1 : entry.body_sz;
+    uint8_t flags = static_cast<uint8_t>(static_cast<uint8_t>(entry.dir) | (entry.alive ? 4 : 0));
+
+    if (baseline && !headOnly && encodeAdvanced(out, flags, body, length, baseline->snakes[player], baseline->Body(player), current.gridSize)) {
+        return;
+    }
+
+    size_t start = out.size();
+    out.push_back(flags | (chainRecord << 4));
+    out.push_back(static_cast<uint8_t>(length));
+    if (length == 0) return;
+    appendCell(out, body[0]);
+    if (appendSteps(out, body, length - 1, current.gridSize)) return;
+
+    out.resize(start);
+    out.push_back(flags | (cellsRecord << 4));
+    out.push_back(static_cast<uint8_t>(length));
+    for (size_t i = 0; i < length; ++i) {
+        appendCell(out, body[i]);
+    }
+}
+
+void SnapshotHistory::Clear()
+{
+    for (auto& snapshot : snapshots) {
+        snapshot.sequence = 0;
+    }
+}
+
+void TakeSnapshot(const Match& match, uint32_t sequence, Snapshot& snapshot)
+{
+    const SnakeTable& snakes = match.GetSnakes();
+    size_t count = snakes.Count();
+    snapshot.sequence = sequence;
+    snapshot.tick = match.GetTick();
+    snapshot.gridSize = match.GetGridSize();
+    snapshot.apple = match.GetApplePosition();
+    snapshot.snakes.resize(count);
+    snapshot.cells.resize(count * maxSnakeSize);
+    for (size_t i = 0; i < count; ++i) {
+        BodyView body = snakes.GetBody(i);
+        snapshot.snakes[i].body_sz = static_cast<uint8_t>(body.size());
+        snapshot.snakes[i].dir = snakes.GetDirection(i);
+        snapshot.snakes[i].alive = snakes.IsAlive(i) ? 1 : 0;
+        body.CopyTo(snapshot.Body(i));
+    }
+}
+
+bool SameState(const Snapshot& snapshot, const Match& match)
+{
+    const SnakeTable& snakes = match.GetSnakes();
+    size_t count = snakes.Count();
+    if (snapshot.snakes.size() != count) {
+        return false;
+    }
+    pos body[maxSnakeSize];
+    for (size_t i = 0; i < count; ++i) {
+        const SnakeStateEntry& entry = snapshot.snakes[i];
+        BodyView view = snakes.GetBody(i);
+        if (entry.body_sz != view.size() || entry.dir != snakes.GetDirection(i) || (entry.alive != 0) != snakes.IsAlive(i)) {
+            return false;
+        }
+        view.CopyTo(body);
+        if (std::memcmp(body, snapshot.Body(i), entry.body_sz * sizeof(pos)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const Snapshot& SnapshotHistory::Push(uint32_t sequence, const Match& match)
+{
+    Snapshot& snapshot = Slot(sequence);
+    TakeSnapshot(match, sequence, snapshot);
+    return snapshot;
+}
+
+const Snapshot* SnapshotHistory::Find(uint32_t sequence) const
+{
+    const Snapshot& snapshot = snapshots[sequence % capacity];
+    return sequence != 0 && snapshot.sequence == sequence ? &snapshot : nullptr;
+}
+
+void FillGameStateMsg(const Snapshot& current, const Snapshot* baseline, std::vector<uint8_t>& buffer)
+{
+    size_t count = current.snakes.size();
+    if (baseline && baseline->snakes.size() != count) baseline = nullptr;
+
+    wire::PutHeader(buffer, MessageType::GameState);
+    wire::PutU8(buffer, static_cast<uint8_t>(count));
+    wire::PutU8(buffer, current.apple.x);
+    wire::PutU8(buffer, current.apple.z);
+    wire::PutU32(buffer, current.sequence);
+    wire::PutU32(buffer, baseline ? baseline->sequence : 0);
+    wire::PutU32(buffer, current.tick);
+
+    for (size_t i = 0; i < count; ++i) {
+        encodeSnake(buffer, current, baseline, i, false);
+    }
+    if (buffer.size() <= maxGameStateSize) {
+        return;
+    }
+
+    // Dead bodies may lie on top of live ones, so only they can push the
+    // message past the limit. They are drawn but no longer matter.
+    buffer.resize(GameStateView::fixedSize);
+    for (size_t i = 0; i < count; ++i) {
+        size_t start = buffer.size();
+        encodeSnake(buffer, current, baseline, i, false);
+        if (!current.snakes[i].alive && buffer.size() - start > 4) {
+            buffer.resize(start);
+            encodeSnake(buffer, current, baseline, i, true);
+        }
+    }
+}
+
+bool ApplyStartGameMsg(Match& match, const StartGameView& msg)
+{
+    size_t count = msg.PlayerCount();
+    if (count == 0 || count > maxPlayers || msg.BodySize() > maxSnakeSize ||
+        msg.GridSizeX() == 0 || msg.GridSizeZ() == 0 || (msg.PlayerId() >= count && msg.PlayerId() != spectatorPlayerId)) {
+        return false;
+    }
+    const pos* bodies = msg.Bodies();
+    for (size_t i = 0; i < count * msg.BodySize(); ++i) {
+        if (bodies[i].x >= msg.GridSizeX() || bodies[i].z >= msg.GridSizeZ()) return false;
+    }
+    if (msg.Apple().x >= msg.GridSizeX() || msg.Apple().z >= msg.GridSizeZ()) {
+        return false;
+    }
+
+    match.SetGridSize(msg.GridSizeX(), msg.GridSizeZ());
+    match.SetPlayerCount(count);
+    match.Start(bodies, msg.BodySize(), msg.Apple());
+    return true;
+}
+
+static bool takeBytes(const uint8_t*& data, const uint8_t* end, size_t count, const uint8_t*& out)
+{
+    if (static_cast<size_t>(end - data) < count) return false;
+    out = data;
+    data += count;
+    return true;
+}
+
+static bool takeCell(const uint8_t*& data, const uint8_t* end, const pos& grid, pos& cell)
+{
+    const uint8_t* bytes;
+    if (!takeBytes(data, end, 2, bytes) || bytes[0] >= grid.x || bytes[1] >= grid.z) return false;
+    cell = pos{ bytes[0], bytes[1] };
+    return true;
+}
+
+static uint8_t stepAt(const uint8_t* steps, size_t i)
+{
+    return (steps[i / 4] >> ((i % 4) * 2)) & 3;
+}
+
+static bool decodeSnake(const uint8_t*& data, const uint8_t* end, Snapshot& out, const Snapshot* baseline, size_t player)
+{
+    const uint8_t* bytes;
+    if (!takeBytes(data, end, 1, bytes) || (bytes[0] & 0xC8) != 0) return false;
+    uint8_t flags = bytes[0];
+    RecordKind kind = static_cast<RecordKind>(flags >> 4);
+    SnakeStateEntry& entry = out.snakes[player];
+    entry.dir = static_cast<Direction>(flags & 3);
+    entry.alive = (flags >> 2) & 1;
+    pos* body = out.Body(player);
+    const pos& grid = out.gridSize;
+
+    if (kind == unchangedRecord || kind == advancedRecord) {
+        if (!baseline) return false;
+        const SnakeStateEntry& base = baseline->snakes[player];
+        const pos* baseBody = baseline->Body(player);
+        if (kind == unchangedRecord) {
+            entry.body_sz = base.body_sz;
+            std::memcpy(body, baseBody, base.body_sz * sizeof(pos));
+            return true;
+        }
+
+        if (!takeBytes(data, end, 2, bytes)) return false;
+        size_t length = bytes[0];
+        size_t added = bytes[1];
+        const uint8_t* steps;
+        if (length > maxSnakeSize || added > length || length - added > base.body_sz || base.body_sz == 0 ||
+            !takeBytes(data, end, (added + 3) / 4, steps)) {
+            return false;
+        }
+        std::memcpy(body + added, baseBody, (length - added) * sizeof(pos));
+        pos cell = baseBody[0];
+        for (size_t i = 0; i < added; ++i) {
+            cell = applyStep(cell, stepAt(steps, i), grid);
+            body[added - 1 - i] = cell;
+        }
+        entry.body_sz = static_cast<uint8_t>(length);
+        return true;
+    }
+
+    if (!takeBytes(data, end, 1, bytes) || bytes[0] > maxSnakeSize) return false;
+    size_t length = bytes[0];
+    entry.body_sz = static_cast<uint8_t>(length);
+    if (kind == cellsRecord) {
+        for (size_t i = 0; i < length; ++i) {
+            if (!takeCell(data, end, grid, body[i])) return false;
+        }
+        return true;
+    }
+
+    if (length == 0) return true;
+    const uint8_t* steps;
+    if (!takeCell(data, end, grid, body[0]) || !takeBytes(data, end, (length + 2) / 4, steps)) return false;
+    for (size_t i = 1; i < length; ++i) {
+        body[i] = applyStep(body[i - 1], stepAt(steps, i - 1), grid);
+    }
+    return true;
+}
+
+bool ApplyGameStateMsg(Match& match, const GameStateView& msg, SnapshotHistory& history)
+{
+    size_t count = msg.PlayerCount();
+    uint32_t sequence = msg.Sequence();
+    const pos& gridSize = match.GetGridSize();
+    if (count != match.GetPlayerCount() || sequence == 0 || msg.Apple().x >= gridSize.x || msg.Apple().z >= gridSize.z) {
+        return false;
+    }
+    const Snapshot* baseline = nullptr;
+    if (msg.Baseline() != 0) {
+        // The baseline must not share a slot with the snapshot being decoded
+        baseline = history.Find(msg.Baseline());
+        if (!baseline || (sequence - msg.Baseline()) % SnapshotHistory::capacity == 0 || baseline->snakes.size() != count) {
+            return false;
+        }
+    }
+
+    Snapshot& snapshot = history.Slot(sequence);
+    snapshot.sequence = 0;
+    snapshot.tick = msg.Tick();
+    snapshot.gridSize = match.GetGridSize();
+    snapshot.apple = msg.Apple();
+    snapshot.snakes.resize(count);
+    snapshot.cells.resize(count * maxSnakeSize);
+
+    const uint8_t* data = msg.Records();
+    const uint8_t* end = data + msg.RecordsSize();
+    for (size_t i = 0; i < count; ++i) {
+        if (!decodeSnake(data, end, snapshot, baseline, i)) return false;
+    }
+    if (data != end) {
+        return false;
+    }
+    snapshot.sequence = sequence;
+
+    match.SetTick(snapshot.tick);
+    match.SetApplePosition(snapshot.apple);
+    for (size_t i = 0; i < count; ++i) {
+        const SnakeStateEntry& entry = snapshot.snakes[i];
+        match.SetSnakeState(i, snapshot.Body(i), entry.body_sz, entry.dir, entry.alive != 0);
+    }
+    return true;
+}
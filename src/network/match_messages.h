@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "messages.h"
+#include "../world/match.h"
+
+// Game state messages are kept below a typical path MTU minus the IP, UDP
+// and ENet headers, so they are never fragmented
+constexpr size_t maxGameStateSize = 1200;
+
+// Upper bound of a full game state with dead snakes cut to their head. A
+// record takes at most 4 bytes and a byte per 4 further cells, and live
+// bodies share the board, so at most maxfieldSizeX * maxfieldSizeZ cells.
+constexpr size_t maxLiveGameStateSize = GameStateView::fixedSize + size_t(maxPlayers) * 5 +
+    size_t(maxfieldSizeX) * size_t(maxfieldSizeZ) / 4;
+static_assert(maxLiveGameStateSize <= maxGameStateSize,
+    "live snakes on the largest board may not fit a game state message");
+
+// Per-snake part of a snapshot
+struct SnakeStateEntry
+{
+    uint8_t body_sz;
+    Direction dir;
+    uint8_t alive;
+};
+
+// One game state as sent or received: every snake body, head first, in a
+// fixed maxSnakeSize slot per player
+struct Snapshot
+{
+    uint32_t sequence = 0;
+    uint32_t tick = 0;
+    pos gridSize{ 0, 0 };
+    pos apple{ 0, 0 };
+    std::vector<SnakeStateEntry> snakes;
+    std::vector<pos> cells;
+
+    const pos* Body(size_t player) const { return cells.data() + player * maxSnakeSize; }
+    pos* Body(size_t player) { return cells.data() + player * maxSnakeSize; }
+};
+
+// Copies the state of match into snapshot
+void TakeSnapshot(const Match& match, uint32_t sequence, Snapshot& snapshot);
+// True if match has the snakes of snapshot: bodies, directions and alive
+// flags. The apple is left out, a client cannot predict where it respawns.
+bool SameState(const Snapshot& snapshot, const Match& match);
+
+// The last few snapshots by sequence number. The server encodes deltas
+// against the one a client acknowledged; the client decodes against its copy.
+class SnapshotHistory {
+public:
+    static constexpr size_t capacity = 32;
+
+    void Clear();
+    // Stores the state of match as snapshot sequence and returns it
+    const Snapshot& Push(uint32_t sequence, const Match& match);
+    // nullptr once the snapshot was overwritten
+    const Snapshot* Find(uint32_t sequence) const;
+    // Storage for snapshot sequence, for decoding in place
+    Snapshot& Slot(uint32_t sequence) { return snapshots[sequence % capacity]; }
+
+private:
+    Snapshot snapshots[capacity];
+};
+
+// Conversions between Match state and the wire messages, shared by the
+// hosted game and the dedicated server. Messages are built into buffer and
+// start at buffer.data(), the buffer size is the message size.
+void FillStartGameMsg(const Match& match, uint8_t playerId, std::vector<uint8_t>& buffer);
+// Readdresses a filled start message to another player
+void SetStartGamePlayerId(std::vector<uint8_t>& buffer, uint8_t playerId);
+// Encodes current against baseline, or in full when baseline is nullptr.
+// If the message would pass maxGameStateSize, dead snakes are cut to their
+// head. Live bodies alone always fit, see maxLiveGameStateSize.
+void FillGameStateMsg(const Snapshot& current, const Snapshot* baseline, std::vector<uint8_t>& buffer);
+
+// Both return false if the message does not describe a valid state.
+// A decoded game state is also stored in history under its sequence.
+bool ApplyStartGameMsg(Match& match, const StartGameView& msg);
+bool ApplyGameStateMsg(Match& match, const GameStateView& msg, SnapshotHistory& history);
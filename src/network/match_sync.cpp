@@ -0,0 +1,111 @@
+#include "match_sync.h"
+
+MatchSender::MatchSender(size_t playerCount) :
+    ackedSequences(playerCount, 0),
+    inputs(playerCount)
+{
+}
+
+void MatchSender::Start()
+{
+    history.Clear();
+    current = nullptr;
+    encodedBaseline = UINT32_MAX;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        ResetSlot(i);
+    }
+}
+
+void MatchSender::ResetSlot(size_t slot)
+{
+    ackedSequences[slot] = 0;
+    inputs[slot].Clear();
+}
+
+void MatchSender::OnSnakeDirChange(Match& match, size_t slot, const SnakeDirChangeView& msg)
+{
+    if (!inputs[slot].Push(msg.Tick(), msg.GetDirection(), match.GetTick())) {
+        match.SetDirection(slot, msg.GetDirection());
+    }
+}
+
+void MatchSender::OnSnapshotAck(size_t slot, const SnapshotAckView& msg)
+{
+    if (msg.Sequence() > ackedSequences[slot] && msg.Sequence() <= sequence) {
+        ackedSequences[slot] = msg.Sequence();
+    }
+}
+
+void MatchSender::ApplyInputs(Match& match)
+{
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        inputs[i].Apply(match, i);
+    }
+}
+
+const Snapshot& MatchSender::PushState(const Match& match)
+{
+    current = &history.Push(++sequence, match);
+    encodedBaseline = UINT32_MAX;
+    return *current;
+}
+
+const std::vector<uint8_t>& MatchSender::StateFor(size_t slot)
+{
+    return encode(history.Find(ackedSequences[slot]));
+}
+
+const std::vector<uint8_t>& MatchSender::StateSincePrevious()
+{
+    return encode(history.Find(sequence - 1));
+}
+
+const std::vector<uint8_t>& MatchSender::FullState()
+{
+    return encode(nullptr);
+}
+
+const std::vector<uint8_t>& MatchSender::encode(const Snapshot* baseline)
+{
+    if (!current) {
+        buffer.clear();
+        encodedBaseline = UINT32_MAX;
+        return buffer;
+    }
+    uint32_t baselineSequence = baseline ? baseline->sequence : 0;
+    if (baselineSequence != encodedBaseline) {
+        FillGameStateMsg(*current, baseline, buffer);
+        encodedBaseline = baselineSequence;
+    }
+    return buffer;
+}
+
+bool MatchReceiver::OnStartGame(Match& match, const StartGameView& msg, bool predict)
+{
+    predicting = false;
+    if (!ApplyStartGameMsg(match, msg)) {
+        return false;
+    }
+    history.Clear();
+    ackedSequence = 0;
+    if (predict) {
+        prediction.Reset(match, msg.PlayerId());
+        predicting = true;
+    }
+    return true;
+}
+
+MatchReceiver::StateResult MatchReceiver::OnGameState(Match& match, const GameStateView& msg, uint32_t roundTripMs)
+{
+    if (msg.Sequence() <= ackedSequence) {
+        return StateResult::Stale;
+    }
+    if (!ApplyGameStateMsg(match, msg, history)) {
+        return StateResult::Invalid;
+    }
+    ackedSequence = msg.Sequence();
+    if (predicting) {
+        prediction.Reconcile(match, Prediction::LeadTicks(roundTripMs));
+    }
+    return StateResult::Applied;
+}
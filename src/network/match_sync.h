@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "messages.h"
+#include "match_messages.h"
+#include "prediction.h"
+#include "../world/match.h"
+#include "../world/input_queue.h"
+
+// Server side of one match's game states, shared by Room, the hosted Game
+// and trons-netsim. Turns of each player slot are held until their tick, and
+// each slot gets the state as a delta against the snapshot it acknowledged.
+class MatchSender {
+public:
+    explicit MatchSender(size_t playerCount);
+
+    // Forgets the turns and acks of the last match. The sequence keeps
+    // counting, so a late ack never names a snapshot of the new match.
+    void Start();
+    // A new peer in slot starts from a full state
+    void ResetSlot(size_t slot);
+
+    void OnSnakeDirChange(Match& match, size_t slot, const SnakeDirChangeView& msg);
+    void OnSnapshotAck(size_t slot, const SnapshotAckView& msg);
+    // Makes the turns due on the coming tick, call right before match.Update()
+    void ApplyInputs(Match& match);
+
+    // Stores the state of match as the next snapshot and returns it
+    const Snapshot& PushState(const Match& match);
+    // The newest state against the snapshot slot acknowledged. Slots usually
+    // acknowledged the same one, so a baseline is encoded once per state.
+    const std::vector<uint8_t>& StateFor(size_t slot);
+    // The newest state against the one before, for peers sent every state reliably
+    const std::vector<uint8_t>& StateSincePrevious();
+    // The newest state in full, empty if there is none in this match
+    const std::vector<uint8_t>& FullState();
+    uint32_t GetSequence() const { return sequence; }
+
+private:
+    const std::vector<uint8_t>& encode(const Snapshot* baseline);
+
+    SnapshotHistory history;
+    const Snapshot* current = nullptr;
+    uint32_t sequence = 0;
+    // Newest snapshot each slot acknowledged
+    std::vector<uint32_t> ackedSequences;
+    std::vector<InputQueue> inputs;
+    std::vector<uint8_t> buffer;
+    // Baseline sequence buffer holds the current state against, 0 for none
+    uint32_t encodedBaseline = UINT32_MAX;
+};
+
+// Client side: applies the server's start and game states to the match and
+// keeps the prediction of the local snake in step with them
+class MatchReceiver {
+public:
+    enum class StateResult { Applied, Stale, Invalid };
+
+    // predict is false for spectators, they have no snake to predict.
+    // Returns false if the message is invalid.
+    bool OnStartGame(Match& match, const StartGameView& msg, bool predict);
+    // Only states newer than the last applied one are used. An applied
+    // state is checked against the prediction with a lead for roundTripMs.
+    StateResult OnGameState(Match& match, const GameStateView& msg, uint32_t roundTripMs);
+    // The prediction stops, what is left to draw is the server's match
+    void Stop() { predicting = false; }
+
+    // Acknowledges the newest applied state
+    SnapshotAckMsg GetAck() const { return SnapshotAckMsg{ ackedSequence }; }
+    bool IsPredicting() const { return predicting; }
+    Prediction& GetPrediction() { return prediction; }
+    const Prediction& GetPrediction() const { return prediction; }
+
+private:
+    SnapshotHistory history;
+    uint32_t ackedSequence = 0;
+    Prediction prediction;
+    bool predicting = false;
+};
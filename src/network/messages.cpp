@@ -0,0 +1,86 @@
+#include "messages.h"
+
+void EncodeStopGame(const StopGameMsg& msg, std::vector<uint8_t>& out)
+{
+    wire::PutHeader(out, MessageType::StopGame);
+    wire::PutU8(out, msg.result.winner);
+}
+
+void EncodeSnakeDirChange(const SnakeDirChangeMsg& msg, std::vector<uint8_t>& out)
+{
+    wire::PutHeader(out, MessageType::SnakeDirChange);
+    wire::PutU8(out, static_cast<uint8_t>(msg.direction));
+    wire::PutU32(out, msg.tick);
+}
+
+void EncodeSnapshotAck(const SnapshotAckMsg& msg, std::vector<uint8_t>& out)
+{
+    wire::PutHeader(out, MessageType::SnapshotAck);
+    wire::PutU32(out, msg.sequence);
+}
+
+const char* MessageTypeName(MessageType type)
+{
+    switch (type) {
+    case MessageType::GameState: return "GameState";
+    case MessageType::StartGame: return "StartGame";
+    case MessageType::StopGame: return "StopGame";
+    case MessageType::SnakeDirChange: return "SnakeDirChange";
+    case MessageType::SnapshotAck: return "SnapshotAck";
+    }
+    return "Unknown";
+}
+
+bool PeekMessageHeader(const uint8_t* data, size_t size, MessageType& type, uint8_t& version)
+{
+    if (size < messageHeaderSize) return false;
+    type = static_cast<MessageType>(data[0]);
+    version = data[1];
+    return true;
+}
+
+static bool checkHeader(const uint8_t* data, size_t size, MessageType type, size_t fixedSize)
+{
+    return size >= fixedSize && data[0] == static_cast<uint8_t>(type) && data[1] == protocolVersion;
+}
+
+bool GameStateView::Parse(const uint8_t* data, size_t dataSize)
+{
+    if (!checkHeader(data, dataSize, MessageType::GameState, fixedSize)) return false;
+    bytes = data;
+    size = dataSize;
+    return true;
+}
+
+bool StartGameView::Parse(const uint8_t* data, size_t size)
+{
+    if (!checkHeader(data, size, MessageType::StartGame, fixedSize)) return false;
+    size_t cells = static_cast<size_t>(data[5]) * data[6];
+    if (size != fixedSize + cells * sizeof(pos)) return false;
+    bytes = data;
+    return true;
+}
+
+bool StopGameView::Parse(const uint8_t* data, size_t size)
+{
+    if (!checkHeader(data, size, MessageType::StopGame, fixedSize) || size != fixedSize) return false;
+    bytes = data;
+    return true;
+}
+
+bool SnakeDirChangeView::Parse(const uint8_t* data, size_t size)
+{
+    if (!checkHeader(data, size, MessageType::SnakeDirChange, fixedSize) || size != fixedSize ||
+        data[2] > static_cast<uint8_t>(Direction::RIGHT)) {
+        return false;
+    }
+    bytes = data;
+    return true;
+}
+
+bool SnapshotAckView::Parse(const uint8_t* data, size_t size)
+{
+    if (!checkHeader(data, size, MessageType::SnapshotAck, fixedSize) || size != fixedSize) return false;
+    bytes = data;
+    return true;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#ifndef GAME_PREF
+    #define GAME_PREF
+    #include "../misc/game_preferences.h"
+#endif
+
+#include "../objects/snake.h"
+#include "../misc/game_types.h"
+
+// Wire messages. Each starts with its type and the protocol version, then
+// fixed fields in little endian without padding; nothing depends on struct
+// layout or enum sizes. Received messages are read through the views below:
+// Parse checks type, version and length once, the accessors then read the
+// fields straight from the packet.
+//
+// Clients also send the version with their connect request, the server
+// refuses other versions with disconnectVersionMismatch | its own version.
+// Spectators add connectSpectator and the room they want to watch, shifted
+// by connectRoomShift; anyRoom watches whichever room is playing. A server
+// with no seat for a spectator disconnects it with disconnectNoSeat.
+
+constexpr uint8_t protocolVersion = 2;
+constexpr uint32_t disconnectVersionMismatch = 0x100;
+constexpr uint32_t disconnectNoSeat = 0x200;
+constexpr uint32_t connectVersionMask = 0xFF;
+constexpr uint32_t connectSpectator = 0x100;
+constexpr uint32_t connectRoomShift = 16;
+constexpr uint32_t anyRoom = 0xFFFF;
+// Player id in the start messages spectators get
+constexpr uint8_t spectatorPlayerId = 0xFF;
+
+enum class MessageType : uint8_t {
+    GameState = 0,
+    StartGame = 1,
+    StopGame = 2,
+    SnakeDirChange = 3,
+    SnapshotAck = 4,
+};
+constexpr size_t messageTypeCount = 5;
+
+const char* MessageTypeName(MessageType type);
+
+constexpr size_t messageHeaderSize = 2;
+
+namespace wire {
+    inline uint32_t ReadU32(const uint8_t* p)
+    {
+        return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+    }
+
+    inline void PutU8(std::vector<uint8_t>& out, uint8_t value) { out.push_back(value); }
+
+    inline void PutU32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        uint8_t bytes[4] = { uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24) };
+        out.insert(out.end(), bytes, bytes + 4);
+    }
+
+    // Starts a message in out, dropping whatever was there
+    inline void PutHeader(std::vector<uint8_t>& out, MessageType type)
+    {
+        out.clear();
+        out.push_back(static_cast<uint8_t>(type));
+        out.push_back(protocolVersion);
+    }
+}
+
+// The cell arrays of the messages are read in place as pos
+static_assert(sizeof(pos) == 2 && alignof(pos) == 1, "pos is sent as two bytes");
+
+// Messages sent by value; the variable-length ones are built by match_messages
+struct StopGameMsg
+{
+    GameResult result;
+};
+
+// tick is the match tick the client turned on, the server holds the turn
+// until its match gets there
+struct SnakeDirChangeMsg
+{
+    Direction direction;
+    uint32_t tick;
+};
+
+// Client to server: the newest snapshot the client has applied
+struct SnapshotAckMsg
+{
+    uint32_t sequence;
+};
+
+void EncodeStopGame(const StopGameMsg& msg, std::vector<uint8_t>& out);
+void EncodeSnakeDirChange(const SnakeDirChangeMsg& msg, std::vector<uint8_t>& out);
+void EncodeSnapshotAck(const SnapshotAckMsg& msg, std::vector<uint8_t>& out);
+
+// Type and version of any message, false if it is too short to have them
+bool PeekMessageHeader(const uint8_t* data, size_t size, MessageType& type, uint8_t& version);
+
+// Layout: player_count, apple x, apple z, sequence, baseline, tick, then
+// player_count snake records, see match_messages.cpp. sequence numbers the
+// snapshots of a match from 1; baseline is the acknowledged snapshot the
+// records are relative to, or 0 when the message holds the full state. tick
+// is Match::GetTick of the state.
+class GameStateView {
+public:
+    static constexpr size_t fixedSize = messageHeaderSize + 15;
+
+    bool Parse(const uint8_t* data, size_t size);
+
+    uint8_t PlayerCount() const { return bytes[2]; }
+    pos Apple() const { return pos{ bytes[3], bytes[4] }; }
+    uint32_t Sequence() const { return wire::ReadU32(bytes + 5); }
+    uint32_t Baseline() const { return wire::ReadU32(bytes + 9); }
+    uint32_t Tick() const { return wire::ReadU32(bytes + 13); }
+    const uint8_t* Records() const { return bytes + fixedSize; }
+    size_t RecordsSize() const { return size - fixedSize; }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t size = 0;
+};
+
+// Layout: grid x, grid z, player id, player count, body size, apple x,
+// apple z, then player_count bodies of body size cells. player_id is the
+// receiving client's slot, or spectatorPlayerId.
+class StartGameView {
+public:
+    static constexpr size_t fixedSize = messageHeaderSize + 7;
+
+    bool Parse(const uint8_t* data, size_t size);
+
+    uint8_t GridSizeX() const { return bytes[2]; }
+    uint8_t GridSizeZ() const { return bytes[3]; }
+    uint8_t PlayerId() const { return bytes[4]; }
+    uint8_t PlayerCount() const { return bytes[5]; }
+    uint8_t BodySize() const { return bytes[6]; }
+    pos Apple() const { return pos{ bytes[7], bytes[8] }; }
+    const pos* Bodies() const { return reinterpret_cast<const pos*>(bytes + fixedSize); }
+
+private:
+    const uint8_t* bytes = nullptr;
+};
+
+// Layout: winner
+class StopGameView {
+public:
+    static constexpr size_t fixedSize = messageHeaderSize + 1;
+
+    bool Parse(const uint8_t* data, size_t size);
+
+    GameResult Result() const { GameResult result; result.winner = bytes[2]; return result; }
+
+private:
+    const uint8_t* bytes = nullptr;
+};
+
+// Layout: direction, tick
+class SnakeDirChangeView {
+public:
+    static constexpr size_t fixedSize = messageHeaderSize + 5;
+
+    bool Parse(const uint8_t* data, size_t size);
+
+    Direction GetDirection() const { return static_cast<Direction>(bytes[2]); }
+    uint32_t Tick() const { return wire::ReadU32(bytes + 3); }
+
+private:
+    const uint8_t* bytes = nullptr;
+};
+
+// Layout: sequence
+class SnapshotAckView {
+public:
+    static constexpr size_t fixedSize = messageHeaderSize + 4;
+
+    bool Parse(const uint8_t* data, size_t size);
+
+    uint32_t Sequence() const { return wire::ReadU32(bytes + 2); }
+
+private:
+    const uint8_t* bytes = nullptr;
+};
@@ -1,7 +1,9 @@
 #include "network_manager.h"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
-NetworkManager::NetworkManager() : host(nullptr), peer(nullptr), isServer(false) 
+NetworkManager::NetworkManager() : host(nullptr), peer(nullptr), isServer(false), connectedPeers(0)
 {
     if (enet_initialize() != 0) {
         assert(0);
@@ -14,19 +16,19 @@ NetworkManager::~NetworkManager()
     enet_deinitialize();
 }
 
-bool NetworkManager::InitializeServer(int& port) 
+bool NetworkManager::InitializeServer(int& port, size_t maxPeers) 
 {
     Shutdown();
     ENetAddress address;
     address.host = ENET_HOST_ANY;
     address.port = port;
 
-    host = enet_host_create(&address, 1, 1, 0, 0);
+    host = enet_host_create(&address, maxPeers, channelCount, 0, 0);
     int counter = 0;
     while (!host && counter < 200) 
     {
         address.port++;
-        host = enet_host_create(&address, 1, 1, 0, 0);
+        host = enet_host_create(&address, maxPeers, channelCount, 0, 0);
         counter++;
     }
     port = address.port;
@@ -37,14 +39,18 @@ bool NetworkManager::InitializeServer(int& port)
     }
     
     isServer = true;
-
-    return true;
+    groups.clear();
+    peerGroups.assign(maxPeers, noGroup);
+    // Room for the messages of every peer and one connection change each
+    received.Reserve(std::max(queueCapacity, maxPeers * (queueEntriesPerPeer + 1)));
+    outgoing.Reserve(std::max(queueCapacity, maxPeers * queueEntriesPerPeer));
+    return start();
 }
 
-bool NetworkManager::InitializeClient(const char* address, int port) 
+bool NetworkManager::InitializeClient(const char* address, int port, bool spectate, uint32_t room) 
 {
     Shutdown();
-    host = enet_host_create(nullptr, 1, 1, 0, 0);
+    host = enet_host_create(nullptr, 1, channelCount, 0, 0);
     if (!host) {
         return false;
     }
@@ -53,7 +59,12 @@ bool NetworkManager::InitializeClient(const char* address, int port)
     enet_address_set_host(&serverAddress, address);
     serverAddress.port = port;
     
-    peer = enet_host_connect(host, &serverAddress, 1, 0);
+    // The server refuses other protocol versions right at the connect
+    uint32_t connectData = protocolVersion;
+    if (spectate) {
+        connectData |= connectSpectator | (room & anyRoom) << connectRoomShift;
+    }
+    peer = enet_host_connect(host, &serverAddress, channelCount, connectData);
     if (!peer) {
         enet_host_destroy(host);
         host = nullptr;
@@ -61,110 +72,450 @@ bool NetworkManager::InitializeClient(const char* address, int port)
     }
     
     isServer = false;
+    return start();
+}
 
+bool NetworkManager::start()
+{
+    ENetAddress loopback;
+    loopback.port = 0;
+    wakeSocket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+    if (wakeSocket == ENET_SOCKET_NULL || enet_address_set_host(&loopback, "127.0.0.1") != 0 ||
+        enet_socket_bind(wakeSocket, &loopback) != 0 || enet_socket_get_address(wakeSocket, &wakeAddress) != 0 ||
+        enet_socket_set_option(wakeSocket, ENET_SOCKOPT_NONBLOCK, 1) != 0) {
+        std::cerr << "Could not open the socket that wakes the network thread" << std::endl;
+        if (wakeSocket != ENET_SOCKET_NULL) enet_socket_destroy(wakeSocket);
+        wakeSocket = ENET_SOCKET_NULL;
+        enet_host_destroy(host);
+        host = nullptr;
+        peer = nullptr;
+        return false;
+    }
+
+    peerCounters.assign(host->peerCount, PeerCounters{});
+    refusedPeers.assign(host->peerCount, false);
+    refusedByGame.assign(host->peerCount, false);
+    pendingDisconnects.clear();
+    for (size_t i = 0; i < messageTypeCount; ++i) {
+        typeSent[i] = TrafficCounter{};
+        typeReceived[i] = TrafficCounter{};
+        dispatchDropped[i] = 0;
+    }
+    lastSample = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats = NetworkStats{};
+    }
+    running.store(true, std::memory_order_release);
+    thread = std::thread(&NetworkManager::run, this);
     return true;
 }
 
-void NetworkManager::Update()
+void NetworkManager::stop()
 {
-    if (!host) return;
+    running.store(false, std::memory_order_release);
+    if (thread.joinable()) {
+        wake();
+        thread.join();
+    }
+    if (wakeSocket != ENET_SOCKET_NULL) {
+        enet_socket_destroy(wakeSocket);
+        wakeSocket = ENET_SOCKET_NULL;
+    }
+    received.Clear();
+    outgoing.Clear();
+}
 
-    ENetEvent event;
-    while (enet_host_service(host, &event, 0) > 0) {
-        switch (event.type) {
-        case ENET_EVENT_TYPE_CONNECT:
-        {
-            peer = event.peer;
-            std::cout << "Connected." << std::endl;
-            onConnectionChange(true);
-            break;
+void NetworkManager::run()
+{
+    while (running.load(std::memory_order_acquire)) {
+        flushOutgoing();
+        if (!pendingDisconnects.empty()) {
+            pushPendingDisconnects();
         }
 
-        case ENET_EVENT_TYPE_RECEIVE: 
-        {
-                void* receivedData = event.packet->data;
-                size_t receivedDataSize = event.packet->dataLength;
-
-                uint8_t type = *(reinterpret_cast<uint8_t*>(receivedData));
-
-                switch (type)
-                {
-                    case (uint8_t(0)): 
-                    {
-                        GameStateMsg* msg = reinterpret_cast<GameStateMsg*>(receivedData);
-                        if(receivedDataSize != sizeof(GameStateMsg))
-                        {
-                            std::cout << "\nGameStateMsg receiving error - receivedDataSize != sizeof(GameStateMsg)\n";
-                            std::cout << " sizeof(GameStateMsg) = " << sizeof(GameStateMsg) << " receivedDataSize = " << receivedDataSize;
-                        }
-                        if (onGameStateReceive )
-                        {
-                            onGameStateReceive(msg);
-                        }
-                        else
-                        {
-                            std::cout << "\nGameStateMsg receiving error\n";
-                        }
-                        break;
-                    }
-                    case (uint8_t(1)):
-                    {
-                        StartGameMsg* msg = reinterpret_cast<StartGameMsg*>(receivedData);
-                        if (onStartGameReceive && receivedDataSize == sizeof(StartGameMsg))
-                        {
-                            onStartGameReceive(msg);
-                        }
-                        else 
-                        {
-                            std::cout << "\nStartGameMsg receiving error\n";
+        wait();
+        ENetEvent event;
+        int result = enet_host_service(host, &event, 0);
+        while (result > 0) {
+            receive(event);
+            result = enet_host_check_events(host, &event);
+        }
+        received.Publish();
+
+        if (peer) {
+            roundTripTime.store(peer->roundTripTime, std::memory_order_relaxed);
+        }
+        Clock::time_point now = Clock::now();
+        if (now - lastSample >= std::chrono::milliseconds(statsPeriodMs)) {
+            sampleStats(now);
+        }
+    }
+    flushOutgoing();
+}
+
+void NetworkManager::wait()
+{
+    // enet_host_service would only return for an event, so the wait covers
+    // the wake socket too and ENet is serviced without blocking after it
+    ENetSocketSet sockets;
+    ENET_SOCKETSET_EMPTY(sockets);
+    ENET_SOCKETSET_ADD(sockets, host->socket);
+    ENET_SOCKETSET_ADD(sockets, wakeSocket);
+    if (enet_socketset_select(std::max(host->socket, wakeSocket), &sockets, nullptr, serviceTimeoutMs) <= 0 ||
+        !ENET_SOCKETSET_CHECK(sockets, wakeSocket)) {
+        return;
+    }
+    // Every wake since the last look is taken at once
+    uint8_t byte;
+    ENetBuffer buffer;
+    buffer.data = &byte;
+    buffer.dataLength = 1;
+    while (enet_socket_receive(wakeSocket, nullptr, &buffer, 1) > 0) {
+    }
+}
+
+void NetworkManager::wake()
+{
+    uint8_t byte = 0;
+    ENetBuffer buffer;
+    buffer.data = &byte;
+    buffer.dataLength = 1;
+    enet_socket_send(wakeSocket, &wakeAddress, &buffer, 1);
+}
+
+void NetworkManager::receive(const ENetEvent& event)
+{
+    EventKind kind;
+    switch (event.type) {
+    case ENET_EVENT_TYPE_CONNECT:
+        if (isServer && (event.data & connectVersionMask) != protocolVersion) {
+            std::cerr << "Refused a client with protocol version " << (event.data & connectVersionMask) << ", this server speaks " << int(protocolVersion) << std::endl;
+            refusedPeers[peerId(event.peer)] = true;
+            enet_peer_disconnect(event.peer, disconnectVersionMismatch | protocolVersion);
+            return;
+        }
+        // A connection the game never hears of must not stay open
+        if (!pendingDisconnects.empty() || freeReceiveSlots() == 0) {
+            std::cerr << "Refused peer " << peerId(event.peer) << ", the receive queue is full" << std::endl;
+            refusedPeers[peerId(event.peer)] = true;
+            enet_peer_disconnect(event.peer, 0);
+            return;
+        }
+        if (!isServer) peer = event.peer;
+        peerCounters[peerId(event.peer)] = PeerCounters{};
+        kind = EventKind::Connect;
+        break;
+    case ENET_EVENT_TYPE_DISCONNECT:
+        if (refusedPeers[peerId(event.peer)]) {
+            // Never announced to the game
+            refusedPeers[peerId(event.peer)] = false;
+            return;
+        }
+        if (isServer) {
+            leaveGroup(peerId(event.peer));
+        }
+        if (!isServer) {
+            peer = nullptr;
+            if (event.data & disconnectVersionMismatch) {
+                std::cerr << "The server speaks protocol version " << (event.data & 0xFF) << ", this client " << int(protocolVersion) << std::endl;
+            }
+            if (event.data & disconnectNoSeat) {
+                std::cerr << "The server has no seat for a spectator" << std::endl;
+            }
+        }
+        kind = EventKind::Disconnect;
+        break;
+    case ENET_EVENT_TYPE_RECEIVE:
+        if (refusedPeers[peerId(event.peer)]) {
+            enet_packet_destroy(event.packet);
+            return;
+        }
+        kind = EventKind::Receive;
+        if (event.packet->dataLength > 0 && event.packet->data[0] < messageTypeCount) {
+            typeReceived[event.packet->data[0]].Add(event.packet->dataLength);
+        }
+        peerCounters[peerId(event.peer)].received.Add(event.packet->dataLength);
+        break;
+    default:
+        return;
+    }
+
+    if (kind == EventKind::Disconnect) {
+        // Never dropped: one that does not fit waits, and everything after it with it
+        if (!pendingDisconnects.empty() || !pushReceived(kind, peerId(event.peer), nullptr, 0)) {
+            pendingDisconnects.push_back(peerId(event.peer));
+        }
+        return;
+    }
+
+    size_t size = kind == EventKind::Receive ? event.packet->dataLength : sizeof(event.data);
+    const void* data = kind == EventKind::Receive ? static_cast<const void*>(event.packet->data) : &event.data;
+    // Data leaves the last slots to connection changes
+    bool fits = size <= maxMessageSize && pendingDisconnects.empty() &&
+        (kind == EventKind::Connect || freeReceiveSlots() > refusedPeers.size());
+    if (!fits || !pushReceived(kind, peerId(event.peer), data, size)) {
+        receiveCounters.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (kind == EventKind::Receive) {
+        enet_packet_destroy(event.packet);
+    }
+}
+
+bool NetworkManager::pushReceived(EventKind kind, uint32_t peerId, const void* data, size_t size)
+{
+    Event* slot = received.BeginPush();
+    if (!slot) {
+        return false;
+    }
+    slot->kind = kind;
+    slot->peerId = peerId;
+    slot->size = static_cast<uint32_t>(size);
+    slot->queued = Clock::now();
+    if (size > 0) std::memcpy(slot->data, data, size);
+    received.EndPush();
+    receiveCounters.Pushed(received.Size() + received.Staged());
+    return true;
+}
+
+size_t NetworkManager::freeReceiveSlots() const
+{
+    return received.Capacity() - received.Size() - received.Staged();
+}
+
+void NetworkManager::pushPendingDisconnects()
+{
+    size_t done = 0;
+    while (done < pendingDisconnects.size() && pushReceived(EventKind::Disconnect, pendingDisconnects[done], nullptr, 0)) {
+        ++done;
+    }
+    pendingDisconnects.erase(pendingDisconnects.begin(), pendingDisconnects.begin() + done);
+}
+
+void NetworkManager::flushOutgoing()
+{
+    bool sent = false;
+    while (Event* event = outgoing.Front()) {
+        if (event->kind == EventKind::DisconnectFromServer) {
+            if (peer) {
+                enet_peer_disconnect(peer, 0);
+                peer = nullptr;
+            }
+        }
+        else if (event->kind == EventKind::DisconnectPeer) {
+            if (event->peerId < host->peerCount && host->peers[event->peerId].state != ENET_PEER_STATE_DISCONNECTED) {
+                enet_peer_disconnect(&host->peers[event->peerId], disconnectNoSeat);
+            }
+        }
+        else if (event->kind == EventKind::JoinGroup) {
+            uint32_t group;
+            std::memcpy(&group, event->data, sizeof(group));
+            joinGroup(group, event->peerId);
+        }
+        else if (event->kind == EventKind::LeaveGroup) {
+            leaveGroup(event->peerId);
+        }
+        else if (event->kind == EventKind::SendToGroup) {
+            if (event->peerId < groups.size() && !groups[event->peerId].empty()) {
+                // Each send takes a reference, the last one sent frees the packet
+                ENetPacket* packet = enet_packet_create(event->data, event->size, ENET_PACKET_FLAG_RELIABLE);
+                if (packet) {
+                    for (ENetPeer* member : groups[event->peerId]) {
+                        if (enet_peer_send(member, controlChannel, packet) == 0) {
+                            countSent(peerId(member), event->data, event->size);
                         }
-                        break;
                     }
-                    case (uint8_t(2)):
-                    {
-                        StopGameMsg* msg = reinterpret_cast<StopGameMsg*>(receivedData);
-                        if (onStopGameReceive && receivedDataSize == sizeof(StopGameMsg))
-                        {
-                            onStopGameReceive(msg);
-                        }
-                        else
-                        {
-                            std::cout << "\nStopGameMsg receiving error\n";
-                        }
-                        break;
+                    if (packet->referenceCount == 0) enet_packet_destroy(packet);
+                    sent = true;
+                }
+            }
+        }
+        else {
+            enet_uint32 flags = event->reliable ? ENET_PACKET_FLAG_RELIABLE : ENET_PACKET_FLAG_UNSEQUENCED;
+            enet_uint8 channel = event->reliable ? controlChannel : stateChannel;
+            ENetPacket* packet = enet_packet_create(event->data, event->size, flags);
+            if (!packet) {
+                std::cout << "error when packing message type " << static_cast<int>(event->data[0]);
+            }
+            else if (event->peerId == allPeers && event->kind == EventKind::Send) {
+                enet_host_broadcast(host, channel, packet);
+                for (size_t i = 0; i < host->peerCount; ++i) {
+                    if (host->peers[i].state == ENET_PEER_STATE_CONNECTED) {
+                        countSent(static_cast<uint32_t>(i), event->data, event->size);
                     }
-                    case (uint8_t(3)):
-                    {
+                }
+            }
+            else {
+                ENetPeer* target = event->kind == EventKind::SendToServer ? peer :
+                    event->peerId < host->peerCount ? &host->peers[event->peerId] : nullptr;
+                if (target && enet_peer_send(target, channel, packet) == 0) {
+                    countSent(peerId(target), event->data, event->size);
+                }
+                if (packet->referenceCount == 0) enet_packet_destroy(packet);
+            }
+            sent = true;
+        }
+        sendCounters.Done(event->queued);
+        outgoing.Pop();
+    }
+    if (sent) {
+        enet_host_flush(host);
+    }
+}
 
-                        SnakeDirChangeMsg* msg = reinterpret_cast<SnakeDirChangeMsg*>(receivedData);
-                        if (onSnakeDirChangeReceive && receivedDataSize == sizeof(SnakeDirChangeMsg))
-                        {
-                            onSnakeDirChangeReceive(msg);
-                        }
-                        else
-                        {
-                            std::cerr << "SnakeDirChangeMsg receiving error";
-                        }
-                        break;
-                    }
+void NetworkManager::countSent(uint32_t peerId, const uint8_t* data, size_t size)
+{
+    if (size > 0 && data[0] < messageTypeCount) {
+        typeSent[data[0]].Add(size);
+    }
+    peerCounters[peerId].sent.Add(size);
+}
 
-                    default:
-                    {
-                        std::cerr << "Unknown message type received " <<static_cast<int>(type) << std::endl;
-                        break;
-                    }
+void NetworkManager::TrafficCounter::Sample(TrafficStats& stats, double seconds)
+{
+    stats.packets = packets;
+    stats.bytes = bytes;
+    stats.packetsPerSecond = (packets - sampledPackets) / seconds;
+    stats.bytesPerSecond = (bytes - sampledBytes) / seconds;
+    sampledPackets = packets;
+    sampledBytes = bytes;
+}
+
+void NetworkManager::sampleStats(Clock::time_point now)
+{
+    double seconds = std::chrono::duration<double>(now - lastSample).count();
+    lastSample = now;
+
+    NetworkStats sample;
+    for (size_t i = 0; i < host->peerCount; ++i) {
+        ENetPeer& p = host->peers[i];
+        if (p.state != ENET_PEER_STATE_CONNECTED) {
+            continue;
+        }
+        PeerCounters& counters = peerCounters[i];
+        // ENet counts timed out reliable commands in packetsLost and restarts
+        // it every few seconds; the few between a sample and a restart are missed
+        counters.retransmits += p.packetsLost >= counters.sampledPacketsLost ? p.packetsLost - counters.sampledPacketsLost : p.packetsLost;
+        counters.sampledPacketsLost = p.packetsLost;
+
+        PeerStats peerStats;
+        peerStats.peerId = static_cast<uint32_t>(i);
+        peerStats.roundTripTimeMs = p.roundTripTime;
+        peerStats.roundTripTimeVarianceMs = p.roundTripTimeVariance;
+        peerStats.packetLoss = static_cast<double>(p.packetLoss) / ENET_PEER_PACKET_LOSS_SCALE;
+        peerStats.reliableInFlight = enet_list_size(&p.sentReliableCommands);
+        peerStats.retransmits = counters.retransmits;
+        counters.sent.Sample(peerStats.sent, seconds);
+        counters.received.Sample(peerStats.received, seconds);
+        sample.peers.push_back(peerStats);
+    }
+    for (size_t i = 0; i < messageTypeCount; ++i) {
+        typeSent[i].Sample(sample.sent[i], seconds);
+        typeReceived[i].Sample(sample.received[i], seconds);
+    }
+    sample.sendQueueDepth = outgoing.Size();
+    sample.receiveQueueDepth = received.Size();
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats = std::move(sample);
+}
+
+NetworkStats NetworkManager::GetStats() const
+{
+    NetworkStats copy;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        copy = stats;
+    }
+    std::copy(std::begin(dispatchDropped), std::end(dispatchDropped), std::begin(copy.dropped));
+    return copy;
+}
+
+void NetworkManager::joinGroup(uint32_t group, uint32_t peerId)
+{
+    // The peer may have left while the request was queued
+    if (peerId >= peerGroups.size() || host->peers[peerId].state != ENET_PEER_STATE_CONNECTED) {
+        return;
+    }
+    leaveGroup(peerId);
+    if (group >= groups.size()) {
+        groups.resize(group + 1);
+    }
+    groups[group].push_back(&host->peers[peerId]);
+    peerGroups[peerId] = group;
+}
+
+void NetworkManager::leaveGroup(uint32_t peerId)
+{
+    if (peerId >= peerGroups.size() || peerGroups[peerId] == noGroup) {
+        return;
+    }
+    auto& members = groups[peerGroups[peerId]];
+    auto it = std::find(members.begin(), members.end(), &host->peers[peerId]);
+    if (it != members.end()) {
+        *it = members.back();
+        members.pop_back();
+    }
+    peerGroups[peerId] = noGroup;
+}
+
+void NetworkManager::Update()
+{
+    if (!host) return;
+
+    while (Event* event = received.Front()) {
+        receiveCounters.Done(event->queued);
+        if (isServer && refusedByGame[event->peerId]) {
+            // The game is done with it, its disconnect only ends the skipping
+            if (event->kind == EventKind::Disconnect) refusedByGame[event->peerId] = false;
+            received.Pop();
+            continue;
+        }
+        switch (event->kind) {
+        case EventKind::Connect:
+        {
+            if (isServer) {
+                ++connectedPeers;
+            } else {
+                serverConnected = true;
+            }
+            std::cout << "Connected." << std::endl;
+            uint32_t connectData;
+            std::memcpy(&connectData, event->data, sizeof(connectData));
+            if (isServer && (connectData & connectSpectator))
+            {
+                if (onSpectatorConnect) {
+                    onSpectatorConnect(event->peerId, connectData >> connectRoomShift & anyRoom);
                 }
-            enet_packet_destroy(event.packet);
+                else {
+                    std::cerr << "Refused spectator " << event->peerId << ", spectating is off" << std::endl;
+                    RefusePeer(event->peerId);
+                }
+            }
+            else if (onConnectionChange)
+            {
+                onConnectionChange(event->peerId, true);
+            }
             break;
         }
 
-        case ENET_EVENT_TYPE_DISCONNECT:
+        case EventKind::Receive:
         {
-            peer = nullptr;
+            Dispatch(event->peerId, event->data, event->size);
+            break;
+        }
+
+        case EventKind::Disconnect:
+        {
+            if (isServer) {
+                if (connectedPeers > 0) --connectedPeers;
+            } else {
+                serverConnected = false;
+            }
             std::cout << "Disconnected." << std::endl;
             if (onConnectionChange)
             {
-                onConnectionChange(false);
+                onConnectionChange(event->peerId, false);
             }
             break;
         }
@@ -172,96 +523,313 @@ void NetworkManager::Update()
         default:
             break;
         }
+        // A callback may have shut the connection down, which empties the queue
+        if (!host) return;
+        received.Pop();
     }
 }
 
-void NetworkManager::Shutdown() 
+void NetworkManager::Dispatch(uint32_t peerId, const uint8_t* data, size_t size)
 {
-    std::cout << "\nvoid NetworkManager::Shutdown() \n";
-    if (peer) {
-        enet_peer_disconnect_now(peer, 0);
-        peer = nullptr;
+    MessageType type;
+    uint8_t version;
+    if (!PeekMessageHeader(data, size, type, version))
+    {
+        std::cerr << "Message too short to have a header" << std::endl;
+        return;
+    }
+    if (version != protocolVersion)
+    {
+        std::cerr << "Dropped a message of protocol version " << int(version) << ", expected " << int(protocolVersion) << std::endl;
+        return;
     }
+
+    switch (type)
+    {
+        case MessageType::GameState:
+        {
+            GameStateView msg;
+            if (onGameStateReceive && msg.Parse(data, size))
+            {
+                onGameStateReceive(msg);
+            }
+            else
+            {
+                ++dispatchDropped[static_cast<size_t>(type)];
+                std::cerr << "GameStateMsg receiving error" << std::endl;
+            }
+            break;
+        }
+        case MessageType::StartGame:
+        {
+            StartGameView msg;
+            if (onStartGameReceive && msg.Parse(data, size))
+            {
+                onStartGameReceive(msg);
+            }
+            else
+            {
+                ++dispatchDropped[static_cast<size_t>(type)];
+                std::cerr << "StartGameMsg receiving error" << std::endl;
+            }
+            break;
+        }
+        case MessageType::StopGame:
+        {
+            StopGameView msg;
+            if (onStopGameReceive && msg.Parse(data, size))
+            {
+                onStopGameReceive(msg);
+            }
+            else
+            {
+                ++dispatchDropped[static_cast<size_t>(type)];
+                std::cerr << "StopGameMsg receiving error" << std::endl;
+            }
+            break;
+        }
+        case MessageType::SnakeDirChange:
+        {
+            SnakeDirChangeView msg;
+            if (onSnakeDirChangeReceive && msg.Parse(data, size))
+            {
+                onSnakeDirChangeReceive(peerId, msg);
+            }
+            else
+            {
+                ++dispatchDropped[static_cast<size_t>(type)];
+                std::cerr << "SnakeDirChangeMsg receiving error" << std::endl;
+            }
+            break;
+        }
+        case MessageType::SnapshotAck:
+        {
+            SnapshotAckView msg;
+            if (onSnapshotAckReceive && msg.Parse(data, size))
+            {
+                onSnapshotAckReceive(peerId, msg);
+            }
+            else
+            {
+                ++dispatchDropped[static_cast<size_t>(type)];
+                std::cerr << "SnapshotAckMsg receiving error" << std::endl;
+            }
+            break;
+        }
+
+        default:
+        {
+            std::cerr << "Unknown message type received " << static_cast<int>(type) << std::endl;
+            break;
+        }
+    }
+}
+
+void NetworkManager::Shutdown() 
+{
     if (host) {
+        stop();
+        for (size_t i = 0; i < host->peerCount; ++i) {
+            if (host->peers[i].state == ENET_PEER_STATE_CONNECTED) {
+                enet_peer_disconnect_now(&host->peers[i], 0);
+            }
+        }
         enet_host_destroy(host);
         host = nullptr;
     }
+    peer = nullptr;
+    connectedPeers = 0;
+    serverConnected = false;
+    roundTripTime.store(0, std::memory_order_relaxed);
 }
 
 void NetworkManager::Disconnect()
 {
-    if (peer) {
-        enet_peer_disconnect(peer, 0);
-        peer = nullptr;
+    if (!isServer) {
+        post(EventKind::DisconnectFromServer, 0, nullptr, 0, true);
+        Flush();
     }
 }
 
-void NetworkManager::sendStartGame(StartGameMsg* msg)
+void NetworkManager::RefusePeer(uint32_t peerId)
+{
+    if (!isServer || peerId >= refusedByGame.size() || refusedByGame[peerId]) return;
+    refusedByGame[peerId] = true;
+    if (connectedPeers > 0) --connectedPeers;
+    post(EventKind::DisconnectPeer, peerId, nullptr, 0, true);
+}
+
+void NetworkManager::sendStartGame(const std::vector<uint8_t>& msg, uint32_t peerId)
 {
     if (!isServer)
     {
-        std::cerr << "attempt to sendSnakeAddBody from client";
+        std::cerr << "attempt to sendStartGame from client";
         return;
     }
-    ENetPacket* packet = enet_packet_create(msg, sizeof(StartGameMsg), 0);
-    if(!packet)
+    post(EventKind::Send, peerId, msg.data(), msg.size(), true);
+}
+
+void NetworkManager::sendGameState(const std::vector<uint8_t>& msg, uint32_t peerId, bool reliable)
+{
+    if (!isServer)
     {
-        std::cout << "couldn't create packet StartGameMsg";
+        std::cerr << "attempt to sendGameState from client";
+        return;
     }
-    enet_peer_send(peer, 0, packet);
-    enet_host_flush(host);
+    post(EventKind::Send, peerId, msg.data(), msg.size(), reliable);
 }
 
-void NetworkManager::sendGameState(GameStateMsg* msg)
+void NetworkManager::sendStopGame(const StopGameMsg& msg, uint32_t peerId)
 {
     if (!isServer)
     {
-        std::cerr << "attempt to sendSnakeAddBody from client";
+        std::cerr << "attempt to sendStopGame from client";
         return;
     }
-    ENetPacket* packet = enet_packet_create(msg, sizeof(GameStateMsg), 0);
-    if(!packet) 
+    EncodeStopGame(msg, sendBuffer);
+    post(EventKind::Send, peerId, sendBuffer.data(), sendBuffer.size(), true);
+}
+
+void NetworkManager::sendSnakeDirChange(const SnakeDirChangeMsg& msg)
+{
+    if (isServer)
     {
-        std::cout << "error when packing StartGameMsg";
+        std::cerr << "attempt to sendSnakeDirChange from server";
         return;
     }
-    enet_peer_send(peer, 0, packet);
-    enet_host_flush(host);
+    // A lost turn would never be made on the server
+    EncodeSnakeDirChange(msg, sendBuffer);
+    post(EventKind::SendToServer, 0, sendBuffer.data(), sendBuffer.size(), true);
 }
 
-void NetworkManager::sendStopGame(StopGameMsg* msg)
+void NetworkManager::sendSnapshotAck(const SnapshotAckMsg& msg)
 {
-    if (!isServer)
+    if (isServer)
     {
-        std::cerr << "attempt to sendStopGame from server";
+        std::cerr << "attempt to sendSnapshotAck from server";
         return;
     }
-    ENetPacket* packet = enet_packet_create(msg, sizeof(StopGameMsg), 0);
-    if (!packet)
+    EncodeSnapshotAck(msg, sendBuffer);
+    post(EventKind::SendToServer, 0, sendBuffer.data(), sendBuffer.size(), false);
+}
+
+void NetworkManager::AddToGroup(uint32_t group, uint32_t peerId)
+{
+    if (!isServer) return;
+    post(EventKind::JoinGroup, peerId, &group, sizeof(group), true);
+}
+
+void NetworkManager::RemoveFromGroup(uint32_t peerId)
+{
+    if (!isServer) return;
+    post(EventKind::LeaveGroup, peerId, nullptr, 0, true);
+}
+
+void NetworkManager::sendToGroup(const std::vector<uint8_t>& msg, uint32_t group)
+{
+    if (!isServer)
     {
-        std::cout << "error when packing StopGameMsg";
+        std::cerr << "attempt to sendToGroup from client";
         return;
     }
-    enet_peer_send(peer, 0, packet);
-    enet_host_flush(host);
+    post(EventKind::SendToGroup, group, msg.data(), msg.size(), true);
 }
 
-void NetworkManager::sendSnakeDirChange(SnakeDirChangeMsg* msg)
+void NetworkManager::post(EventKind kind, uint32_t peerId, const void* data, size_t size, bool reliable)
 {
-    if (isServer)
+    if (!host)
     {
-        std::cerr << "attempt to sendSnakeDirChange from server";
         return;
     }
-
-    ENetPacket* packet = enet_packet_create(msg, sizeof(SnakeDirChangeMsg), 0);
-    if (!packet)
+    if (size > maxMessageSize)
     {
-        std::cout << "error when packing SnakeDirChangeMsg";
+        std::cerr << "Dropped a message of " << size << " bytes, the limit is " << maxMessageSize << std::endl;
+        sendCounters.dropped.fetch_add(1, std::memory_order_relaxed);
         return;
     }
-    enet_peer_send(peer, 0, packet);
-    enet_host_flush(host);
+    Event* event = outgoing.BeginPush();
+    if (!event && reliable)
+    {
+        // Hands over what the queue holds and waits for the network thread
+        // to make room, reliable messages are not dropped for a full queue
+        outgoing.Publish();
+        wake();
+        Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(reliableSendWaitMs);
+        while (!(event = outgoing.BeginPush()) && running.load(std::memory_order_acquire) && Clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+    }
+    if (!event)
+    {
+        // Hands over what the queue holds, so it drains
+        outgoing.Publish();
+        wake();
+        sendCounters.dropped.fetch_add(1, std::memory_order_relaxed);
+        if (reliable) {
+            std::cerr << "The send queue stayed full, dropped a reliable message for peer " << peerId << std::endl;
+        }
+        return;
+    }
+    event->kind = kind;
+    event->reliable = reliable;
+    event->peerId = peerId;
+    event->size = static_cast<uint32_t>(size);
+    event->queued = Clock::now();
+    if (size > 0) std::memcpy(event->data, data, size);
+    outgoing.EndPush();
+    sendCounters.Pushed(outgoing.Size() + outgoing.Staged());
 }
 
+void NetworkManager::Flush()
+{
+    // Most frames send nothing and leave the network thread asleep
+    if (host && outgoing.Staged() > 0)
+    {
+        outgoing.Publish();
+        wake();
+    }
+}
 
+void NetworkManager::ResetQueueStats()
+{
+    receiveCounters.Reset();
+    sendCounters.Reset();
+}
+
+void NetworkManager::QueueCounters::Pushed(size_t depth)
+{
+    size_t seen = maxDepth.load(std::memory_order_relaxed);
+    while (depth > seen && !maxDepth.compare_exchange_weak(seen, depth, std::memory_order_relaxed)) {
+    }
+}
+
+void NetworkManager::QueueCounters::Done(Clock::time_point queued)
+{
+    int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - queued).count();
+    messages.fetch_add(1, std::memory_order_relaxed);
+    totalLatencyNs.fetch_add(latency, std::memory_order_relaxed);
+    int64_t seen = maxLatencyNs.load(std::memory_order_relaxed);
+    while (latency > seen && !maxLatencyNs.compare_exchange_weak(seen, latency, std::memory_order_relaxed)) {
+    }
+}
+
+NetworkQueueStats NetworkManager::QueueCounters::Get(size_t depth) const
+{
+    NetworkQueueStats stats;
+    stats.messages = messages.load(std::memory_order_relaxed);
+    stats.dropped = dropped.load(std::memory_order_relaxed);
+    stats.depth = depth;
+    stats.maxDepth = maxDepth.load(std::memory_order_relaxed);
+    stats.totalLatencyNs = totalLatencyNs.load(std::memory_order_relaxed);
+    stats.maxLatencyNs = maxLatencyNs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void NetworkManager::QueueCounters::Reset()
+{
+    messages.store(0, std::memory_order_relaxed);
+    dropped.store(0, std::memory_order_relaxed);
+    maxDepth.store(0, std::memory_order_relaxed);
+    totalLatencyNs.store(0, std::memory_order_relaxed);
+    maxLatencyNs.store(0, std::memory_order_relaxed);
+}
@@ -1,81 +1,297 @@
 #pragma once
 
 #include <enet/enet.h>
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
+#include <vector>
 #include <functional>
-#include <glm.hpp>
+#include <mutex>
 
-#ifndef GAME_PREF 
-    #define GAME_PREF
-    #include "../misc/game_preferences.h"
-#endif 
+#include "messages.h"
+#include "../misc/spsc_queue.h"
 
-#include "../objects/snake.h"
-#include "../misc/game_types.h"
-
-struct pos
+// Traffic through one of the queues between the game and network threads
+struct NetworkQueueStats
 {
-    uint8_t x;
-    uint8_t z;
-};
+    uint64_t messages = 0;
+    // Lost because the queue was full
+    uint64_t dropped = 0;
+    size_t depth = 0;
+    size_t maxDepth = 0;
+    // From entering the queue to being dispatched or handed to ENet
+    int64_t totalLatencyNs = 0;
+    int64_t maxLatencyNs = 0;
 
-struct GameStateMsg
-{
-    uint8_t type = uint8_t(0);
-    uint8_t snake1_body_sz = 3;
-    uint8_t snake2_body_sz = 3;
-    Direction snake1_dir;
-    Direction snake2_dir;
-    pos snake1_body[maxSnakeSize], snake2_body[maxSnakeSize], apple_pos;
+    int64_t MeanLatencyNs() const { return messages > 0 ? totalLatencyNs / static_cast<int64_t>(messages) : 0; }
 };
 
-struct StartGameMsg
+// Packets and bytes handed to or received from ENet
+struct TrafficStats
 {
-    uint8_t type = uint8_t(1);
-    uint8_t grid_size_x;
-    uint8_t grid_size_z;
-    pos snake1_body[3], snake2_body[3], apple_pos;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    // Over the last stats period
+    double packetsPerSecond = 0.0;
+    double bytesPerSecond = 0.0;
 };
 
-struct StopGameMsg
+struct PeerStats
 {
-    uint8_t type = uint8_t(2);
-    GameResult result;
+    uint32_t peerId = 0;
+    // ENet's smoothed round trip time and its variation
+    uint32_t roundTripTimeMs = 0;
+    uint32_t roundTripTimeVarianceMs = 0;
+    // ENet's estimate, 0 to 1
+    double packetLoss = 0.0;
+    // Reliable commands sent and not acknowledged yet
+    size_t reliableInFlight = 0;
+    // Reliable commands sent again after a timeout
+    uint64_t retransmits = 0;
+    TrafficStats sent;
+    TrafficStats received;
 };
 
-struct SnakeDirChangeMsg 
+// Taken by the network thread once per statsPeriodMs
+struct NetworkStats
 {
-    uint8_t type = uint8_t(3);
-    Direction direction;
+    // Connected peers only
+    std::vector<PeerStats> peers;
+    // By MessageType
+    TrafficStats sent[messageTypeCount];
+    TrafficStats received[messageTypeCount];
+    // Messages of a known type dropped by Dispatch, malformed or unhandled
+    uint64_t dropped[messageTypeCount] = {};
+    size_t sendQueueDepth = 0;
+    size_t receiveQueueDepth = 0;
 };
 
+// ENet runs on a thread of its own, which sleeps until traffic arrives or
+// Flush wakes it through a loopback socket. Received messages and connection changes wait in a queue until Update hands them
+// to the callbacks on the game thread; sends go the other way, so the game
+// thread never touches ENet and only waits for it when a reliable send
+// finds the send queue full. Connection changes are never dropped from the
+// receive queue, data is dropped first. Sends are held until
+// Flush, which hands a tick's messages to ENet together; ENet then packs
+// them into as few datagrams as it can.
+//
+// Channel 0 carries start, stop and turn messages reliably and in order.
+// Game states and acks go unsequenced on channel 1: only the newest one
+// matters, so a lost one is not resent and a late one never holds back a
+// newer one.
+//
+// The server can put peers into groups, such as the spectators of a room. A
+// message for a group becomes one ENet packet that every peer of the group
+// holds a reference to, so a recipient costs a queued command and no copy.
 class NetworkManager {
 public:
     NetworkManager();
     ~NetworkManager();
 
-    bool InitializeServer(int& port);
-    bool InitializeClient(const char* address, int port = 1234);
+    // maxPeers is 1 for a hosted game, the dedicated server takes one per player
+    bool InitializeServer(int& port, size_t maxPeers = 1);
+    // A spectator watches room without playing, see connectSpectator
+    bool InitializeClient(const char* address, int port = 1234, bool spectate = false, uint32_t room = anyRoom);
+    // Runs the callbacks for everything received since the last call
     void Update();
+    // Sends everything queued since the last call, once per tick
+    void Flush();
+    // Checks one received message and hands it to its callback, Update calls
+    // it for every packet. Messages of another protocol version are dropped.
+    void Dispatch(uint32_t peerId, const uint8_t* data, size_t size);
     void Shutdown();
     void Disconnect();
+    // Server side, turns away a connected peer the game has no place for.
+    // Its disconnect and anything it still sent are not reported.
+    void RefusePeer(uint32_t peerId);
+
+    // Server side sends go to every connected peer unless one is given.
+    // Start and state messages come encoded, see match_messages.h.
+    void sendStartGame(const std::vector<uint8_t>& msg, uint32_t peerId = allPeers);
+    // The last state of a match goes reliable, so it arrives ahead of the
+    // stop message on the control channel
+    void sendGameState(const std::vector<uint8_t>& msg, uint32_t peerId = allPeers, bool reliable = false);
+    void sendStopGame(const StopGameMsg& msg, uint32_t peerId = allPeers);
+    void sendSnakeDirChange(const SnakeDirChangeMsg& msg);
+    void sendSnapshotAck(const SnapshotAckMsg& msg);
+
+    // A peer is in one group at most, and leaves it when it disconnects
+    void AddToGroup(uint32_t group, uint32_t peerId);
+    void RemoveFromGroup(uint32_t peerId);
+    // Sent reliably, on the control channel
+    void sendToGroup(const std::vector<uint8_t>& msg, uint32_t group);
 
-    void sendStartGame(StartGameMsg* msg);
-    void sendGameState(GameStateMsg* msg);
-    void sendStopGame(StopGameMsg* msg);
-    void sendSnakeDirChange(SnakeDirChangeMsg* msg);
+    static constexpr uint32_t allPeers = UINT32_MAX;
+    static constexpr uint32_t noGroup = UINT32_MAX;
+    static constexpr enet_uint8 controlChannel = 0;
+    static constexpr enet_uint8 stateChannel = 1;
+    static constexpr size_t channelCount = 2;
+    // Larger packets are dropped
+    static constexpr size_t maxMessageSize = 1280;
+    // Smallest queue size; a server queues a few messages per peer and tick
+    static constexpr size_t queueCapacity = 512;
+    static constexpr size_t queueEntriesPerPeer = 2;
+    // Longest the network thread sleeps with no traffic and nothing to send,
+    // it only paces ENet's pings and resends
+    static constexpr uint32_t serviceTimeoutMs = 50;
+    // Longest a reliable send waits for room in a full send queue
+    static constexpr uint32_t reliableSendWaitMs = 100;
+    static constexpr uint32_t statsPeriodMs = 1000;
 
     bool IsServer() const { return isServer; }
-    bool IsConnected() const { return peer != nullptr && peer->state == ENET_PEER_STATE_CONNECTED; }
-   
-    std::function<void(bool)> onConnectionChange = nullptr;
-    std::function<void(StartGameMsg*)> onStartGameReceive = nullptr;
-    std::function<void(GameStateMsg*)> onGameStateReceive = nullptr;
-    std::function<void(StopGameMsg*)> onStopGameReceive = nullptr;
-    std::function<void(SnakeDirChangeMsg*)> onSnakeDirChangeReceive = nullptr;
+    // As of the connection changes handed out by Update
+    bool IsConnected() const { return isServer ? connectedPeers > 0 : serverConnected; }
+    size_t GetConnectedPeers() const { return connectedPeers; }
+    // Client side, ENet's smoothed round trip time to the server in ms
+    uint32_t GetRoundTripTime() const { return roundTripTime.load(std::memory_order_relaxed); }
+
+    // A copy of the latest sample, cheap enough to take every frame
+    NetworkStats GetStats() const;
+    NetworkQueueStats GetReceiveStats() const { return receiveCounters.Get(received.Size()); }
+    NetworkQueueStats GetSendStats() const { return sendCounters.Get(outgoing.Size()); }
+    void ResetQueueStats();
+
+    // Peer ids are slots in the host peer table, stable for the whole connection
+    std::function<void(uint32_t, bool)> onConnectionChange = nullptr;
+    // Server side, a spectator connected to watch a room, or anyRoom. Its
+    // disconnect goes to onConnectionChange. Without this callback
+    // spectators are refused, they never take a player's place.
+    std::function<void(uint32_t, uint32_t)> onSpectatorConnect = nullptr;
+    // The views point into the received packet, only valid during the call
+    std::function<void(const StartGameView&)> onStartGameReceive = nullptr;
+    std::function<void(const GameStateView&)> onGameStateReceive = nullptr;
+    std::function<void(const StopGameView&)> onStopGameReceive = nullptr;
+    std::function<void(uint32_t, const SnakeDirChangeView&)> onSnakeDirChangeReceive = nullptr;
+    std::function<void(uint32_t, const SnapshotAckView&)> onSnapshotAckReceive = nullptr;
 
 private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class EventKind : uint8_t {
+        Connect,
+        Disconnect,
+        Receive,
+        // Sends, peerId allPeers broadcasts
+        Send,
+        SendToServer,
+        DisconnectFromServer,
+        // Server side, disconnects peerId with disconnectNoSeat
+        DisconnectPeer,
+        // peerId is the group
+        SendToGroup,
+        // The group is in data
+        JoinGroup,
+        LeaveGroup,
+    };
+
+    // Connect events carry the connect data in data
+    struct Event {
+        EventKind kind;
+        // Sends: reliable on the control channel or unsequenced on the state channel
+        bool reliable;
+        uint32_t peerId;
+        uint32_t size;
+        Clock::time_point queued;
+        uint8_t data[maxMessageSize];
+    };
+
+    // Network thread, running totals and their values at the last sample
+    struct TrafficCounter {
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        uint64_t sampledPackets = 0;
+        uint64_t sampledBytes = 0;
+
+        void Add(size_t size) { ++packets; bytes += size; }
+        void Sample(TrafficStats& stats, double seconds);
+    };
+
+    struct PeerCounters {
+        TrafficCounter sent;
+        TrafficCounter received;
+        uint32_t sampledPacketsLost = 0;
+        uint64_t retransmits = 0;
+    };
+
+    // Written from both threads, hence atomic
+    struct QueueCounters {
+        std::atomic<uint64_t> messages{ 0 };
+        std::atomic<uint64_t> dropped{ 0 };
+        std::atomic<size_t> maxDepth{ 0 };
+        std::atomic<int64_t> totalLatencyNs{ 0 };
+        std::atomic<int64_t> maxLatencyNs{ 0 };
+
+        void Pushed(size_t depth);
+        void Done(Clock::time_point queued);
+        NetworkQueueStats Get(size_t depth) const;
+        void Reset();
+    };
+
+    // Starts the network thread, false if its wake socket cannot be opened
+    bool start();
+    void stop();
+    // Game thread, ends the network thread's wait
+    void wake();
+    // Network thread
+    void run();
+    // Sleeps until traffic arrives, wake is called or serviceTimeoutMs passes
+    void wait();
+    void receive(const ENetEvent& event);
+    bool pushReceived(EventKind kind, uint32_t peerId, const void* data, size_t size);
+    size_t freeReceiveSlots() const;
+    void pushPendingDisconnects();
+    void flushOutgoing();
+    void countSent(uint32_t peerId, const uint8_t* data, size_t size);
+    void sampleStats(Clock::time_point now);
+    void joinGroup(uint32_t group, uint32_t peerId);
+    void leaveGroup(uint32_t peerId);
+    void post(EventKind kind, uint32_t peerId, const void* data, size_t size, bool reliable);
+    uint32_t peerId(const ENetPeer* p) const { return static_cast<uint32_t>(p - host->peers); }
+
+    // Owned by the network thread while it runs
     ENetHost* host;
     ENetPeer* peer;
     bool isServer;
+    // Peers refused for their protocol version or a full receive queue,
+    // their disconnect is not announced
+    std::vector<bool> refusedPeers;
+    // Disconnects that did not fit into the receive queue, in order. Until
+    // they are queued new connections are refused and data is dropped.
+    std::vector<uint32_t> pendingDisconnects;
+    // Server side, peers by group and the group of every peer
+    std::vector<std::vector<ENetPeer*>> groups;
+    std::vector<uint32_t> peerGroups;
+
+    // Game thread view of the connections
+    size_t connectedPeers;
+    // Peers the game refused, their events are skipped until the disconnect
+    std::vector<bool> refusedByGame;
+    bool serverConnected = false;
+    // Encoding scratch for the fixed-size messages
+    std::vector<uint8_t> sendBuffer;
+
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    // Bound to loopback, the game thread sends it a byte to wake the network thread
+    ENetSocket wakeSocket = ENET_SOCKET_NULL;
+    ENetAddress wakeAddress;
+    std::atomic<uint32_t> roundTripTime{ 0 };
+    // Network thread to game thread
+    SpscQueue<Event> received{ queueCapacity };
+    // Game thread to network thread
+    SpscQueue<Event> outgoing{ queueCapacity };
+    QueueCounters receiveCounters;
+    QueueCounters sendCounters;
+
+    // Network thread
+    std::vector<PeerCounters> peerCounters;
+    TrafficCounter typeSent[messageTypeCount];
+    TrafficCounter typeReceived[messageTypeCount];
+    Clock::time_point lastSample;
+    // Game thread
+    uint64_t dispatchDropped[messageTypeCount] = {};
+    // Latest sample, handed from the network thread to GetStats
+    mutable std::mutex statsMutex;
+    NetworkStats stats;
 };
@@ -0,0 +1,130 @@
+#include "prediction.h"
+#include <algorithm>
+
+void Prediction::Reset(const Match& match, size_t localPlayer)
+{
+    predicted = match;
+    player = localPlayer;
+    holdTicks = 0;
+    for (auto& state : states) {
+        state.sequence = 0;
+    }
+    for (auto& in : inputs) {
+        in.tick = UINT32_MAX;
+        in.count = 0;
+    }
+    record();
+}
+
+uint32_t Prediction::AddInput(Direction dir)
+{
+    uint32_t tick = predicted.GetTick();
+    TickInputs& in = inputs[tick % historyTicks];
+    if (in.tick != tick) {
+        in.tick = tick;
+        in.count = 0;
+    }
+    if (in.count < maxTurnsPerTick) {
+        in.dirs[in.count++] = dir;
+    }
+    predicted.SetDirection(player, dir);
+    return tick;
+}
+
+void Prediction::Step()
+{
+    if (holdTicks > 0) {
+        --holdTicks;
+        return;
+    }
+    if (predicted.GetState() != GameState::Active) return;
+    simulate();
+    ++stats.predictedTicks;
+}
+
+void Prediction::simulate()
+{
+    // Turns of this tick are set again after a rewind, repeating one is harmless
+    const TickInputs& in = inputs[predicted.GetTick() % historyTicks];
+    if (in.tick == predicted.GetTick()) {
+        for (size_t i = 0; i < in.count; ++i) {
+            predicted.SetDirection(player, in.dirs[i]);
+        }
+    }
+    predicted.Update();
+    record();
+}
+
+void Prediction::record()
+{
+    // sequence only marks the slot as used
+    TakeSnapshot(predicted, 1, states[predicted.GetTick() % historyTicks]);
+}
+
+void Prediction::rewind(const Match& authoritative, uint32_t targetTick)
+{
+    predicted = authoritative;
+    record();
+    while (predicted.GetTick() < targetTick && predicted.GetState() == GameState::Active) {
+        simulate();
+    }
+}
+
+void Prediction::Reconcile(const Match& authoritative, uint32_t leadTicks)
+{
+    uint32_t serverTick = authoritative.GetTick();
+    uint32_t tick = predicted.GetTick();
+    uint32_t wantedTick = serverTick + leadTicks;
+    ++stats.reconciledStates;
+
+    bool behind = serverTick > tick;
+    bool predictedRight = false;
+    bool appleEaten = false;
+    if (!behind && tick - serverTick < historyTicks) {
+        const Snapshot& state = states[serverTick % historyTicks];
+        predictedRight = state.sequence != 0 && state.tick == serverTick && SameState(state, authoritative);
+        appleEaten = state.apple != predicted.GetApplePosition();
+    }
+
+    // One tick either way is left alone, so round trip jitter does not
+    // make the lead swing back and forth
+    uint32_t targetTick = tick;
+    if (tick + 1 < wantedTick) {
+        targetTick = wantedTick;
+        holdTicks = 0;
+    }
+    else if (tick > wantedTick + 1) {
+        if (predictedRight) {
+            holdTicks = tick - wantedTick;
+        }
+        else {
+            targetTick = wantedTick;
+        }
+    }
+
+    if (predictedRight) {
+        // The client rng is not the server's, so only the server knows where
+        // an apple respawns. Its apple is kept unless the prediction has eaten
+        // it since, then the next server state brings the new one.
+        if (!appleEaten) {
+            predicted.SetApplePosition(authoritative.GetApplePosition());
+        }
+        // Only catching up, the states so far were right
+        while (predicted.GetTick() < targetTick && predicted.GetState() == GameState::Active) {
+            simulate();
+        }
+        return;
+    }
+
+    if (behind) {
+        ++stats.resyncs;
+    }
+    else {
+        ++stats.mispredictions;
+    }
+    uint32_t depth = targetTick - std::min(serverTick, targetTick);
+    stats.lastCorrectionDepth = depth;
+    stats.maxCorrectionDepth = std::max(stats.maxCorrectionDepth, depth);
+    stats.totalCorrectionDepth += depth;
+    rewind(authoritative, targetTick);
+}
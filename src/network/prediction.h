@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+#include "match_messages.h"
+#include "../world/match.h"
+
+struct PredictionStats
+{
+    uint64_t predictedTicks = 0;
+    // Server states checked against the prediction
+    uint64_t reconciledStates = 0;
+    // Server states the prediction got wrong
+    uint64_t mispredictions = 0;
+    // Times the prediction fell behind the server and was restarted from it
+    uint64_t resyncs = 0;
+    // Ticks simulated again per correction
+    uint32_t lastCorrectionDepth = 0;
+    uint32_t maxCorrectionDepth = 0;
+    uint64_t totalCorrectionDepth = 0;
+
+    uint64_t Corrections() const { return mispredictions + resyncs; }
+    double MeanCorrectionDepth() const { return Corrections() > 0 ? double(totalCorrectionDepth) / double(Corrections()) : 0.0; }
+};
+
+// Client side prediction. The local snake moves as soon as it is turned
+// instead of a round trip later; the other snakes keep their last known
+// direction. The predicted state of every recent tick is kept, and when a
+// server state disagrees with it the match is rewound to the server state
+// and the local turns made since are simulated again.
+class Prediction {
+public:
+    static constexpr uint32_t historyTicks = 64;
+    static constexpr size_t maxTurnsPerTick = 4;
+
+    // Predicts on from match, a match just started or a server state.
+    // player is the local snake.
+    void Reset(const Match& match, size_t player);
+    // Turns the local snake on the current tick, which is returned to be
+    // sent along with the turn
+    uint32_t AddInput(Direction dir);
+    // Runs one predicted tick
+    void Step();
+    // Checks the prediction against a server state. leadTicks is how far the
+    // prediction should run ahead of it, about a round trip, so local turns
+    // reach the server before it runs their tick.
+    void Reconcile(const Match& authoritative, uint32_t leadTicks);
+    // Lead for a round trip of roundTripMs. A turn is sent a round trip after
+    // the server state it is predicted from, so it has to be for a later tick
+    // than the server reaches by then.
+    static uint32_t LeadTicks(uint32_t roundTripMs) { return roundTripMs / tickIntervalMs + 1; }
+
+    const Match& GetMatch() const { return predicted; }
+    uint32_t GetTick() const { return predicted.GetTick(); }
+    const PredictionStats& GetStats() const { return stats; }
+    void ResetStats() { stats = PredictionStats{}; }
+
+private:
+    struct TickInputs {
+        uint32_t tick;
+        uint8_t count;
+        Direction dirs[maxTurnsPerTick];
+    };
+
+    // Applies the local turns of the current tick, runs it and stores the result
+    void simulate();
+    void record();
+    void rewind(const Match& authoritative, uint32_t targetTick);
+
+    Match predicted;
+    size_t player = 0;
+    // State after tick t and the turns made on tick t, both at t % historyTicks
+    Snapshot states[historyTicks];
+    TickInputs inputs[historyTicks];
+    // Ticks to skip because the prediction ran too far ahead
+    uint32_t holdTicks = 0;
+    PredictionStats stats;
+};
@@ -6,106 +6,111 @@
 
 void printDirection(Direction dir);
 
-Snake::Snake() : currentDirection(Direction::FORWARD), lastDirection(Direction::FORWARD), isAlive(true)
+static bool IsOppositeDirection(Direction dir1, Direction dir2);
+
+SnakeTable::SnakeTable(size_t count) : maxLength(maxSnakeSize)
 {
-    bodyParts.reserve(maxSnakeSize);
-    Reset();
+    Resize(count);
 }
 
-void Snake::Reset() {
-    bodyParts.clear();
-    isAlive = true;
-    currentDirection = Direction::FORWARD;
-    lastDirection = Direction::FORWARD;
+void SnakeTable::Resize(size_t count)
+{
+    heads.resize(count);
+    directions.resize(count);
+    lastDirections.resize(count);
+    headIndices.resize(count);
+    lengths.resize(count);
+    pendingGrowth.resize(count);
+    alive.resize(count);
+    bodies.resize(count * maxLength);
+    for (size_t i = 0; i < count; ++i) {
+        Reset(i);
+    }
 }
 
-void Snake::Update(const glm::vec2& gridSize) {
-    if (!isAlive) return;
-
-    // Store current head position
-    glm::vec2 oldHeadPos = bodyParts.front();
-    glm::vec2 newHeadPos = oldHeadPos;
+void SnakeTable::Reset(size_t player)
+{
+    heads[player] = pos{ 0, 0 };
+    headIndices[player] = 0;
+    lengths[player] = 0;
+    pendingGrowth[player] = 0;
+    alive[player] = 1;
+    directions[player] = Direction::FORWARD;
+    lastDirections[player] = Direction::FORWARD;
+}
 
-    // Update head position based on direction
-    switch (currentDirection) {
-        case Direction::FORWARD:
-            newHeadPos.y -= 1;
-            break;
-        case Direction::BACKWARD:
-            newHeadPos.y += 1;
-            break;
-        case Direction::LEFT:
-            newHeadPos.x -= 1;
-            break;
-        case Direction::RIGHT:
-            newHeadPos.x += 1;
-            break;
+bool SnakeTable::Advance(size_t player, const pos& newHead, pos& tail)
+{
+    lastDirections[player] = directions[player];
+
+    // Grow by keeping the tail for this move, otherwise the tail cell is retired
+    bool dropsTail = true;
+    if (pendingGrowth[player] > 0 && lengths[player] < maxLength) {
+        --pendingGrowth[player];
+        ++lengths[player];
+        dropsTail = false;
     }
-    lastDirection = currentDirection;
-
-    // Wrap the position if needed
-    WrapPosition(newHeadPos, gridSize);
-
-    // Move body parts
-    for (size_t i = bodyParts.size() - 1; i > 0; --i) {
-        bodyParts[i] = bodyParts[i - 1];
+    else {
+        tail = GetBody(player).back();
     }
-    bodyParts[0] = newHeadPos;
 
-    // Check for collisions
-    if (CheckCollision()) {
-        isAlive = false;
-        return;
-    }
+    // Move body parts: step the head back one slot, the old tail slot drops out of the ring
+    size_t headIndex = headIndices[player];
+    headIndex = (headIndex == 0) ? maxLength - 1 : headIndex - 1;
+    headIndices[player] = static_cast<uint16_t>(headIndex);
+    bodies[player * maxLength + headIndex] = newHead;
+    heads[player] = newHead;
+    return dropsTail;
 }
 
-bool Snake::SetDirection(Direction dir) 
+bool SnakeTable::SetDirection(size_t player, Direction dir)
 {
     // Prevent changing to opposite direction
-    if (IsOppositeDirection(dir, lastDirection)) {
+    if (IsOppositeDirection(dir, lastDirections[player])) {
         return false;
     }
-    currentDirection = dir;
+    directions[player] = dir;
     return true;
 }
 
-void Snake::AddBodyPart(const glm::vec2& pos) 
+void SnakeTable::ForceDirection(size_t player, Direction dir)
 {
-    if (maxSnakeSize <= bodyParts.size())
+    directions[player] = dir;
+    lastDirections[player] = dir;
+}
+
+void SnakeTable::AddBodyPart(size_t player, const pos& part)
+{
+    size_t length = lengths[player];
+    if (maxLength <= length)
     {
         return;
     }
-    bodyParts.push_back(pos);
+    size_t tailIndex = headIndices[player] + length;
+    if (tailIndex >= maxLength) tailIndex -= maxLength;
+    bodies[player * maxLength + tailIndex] = part;
+    if (length == 0) heads[player] = part;
+    lengths[player] = static_cast<uint16_t>(length + 1);
 }
 
-bool Snake::CheckCollision() const {
-    // Get head position
-    const glm::vec2& head = bodyParts.front();
-
-    // Check collision with body
-    for (size_t i = 1; i < bodyParts.size(); ++i) {
-        if (head == bodyParts[i]) {
-            return true;
-        }
+void SnakeTable::Grow(size_t player)
+{
+    if (lengths[player] + pendingGrowth[player] < maxLength) {
+        ++pendingGrowth[player];
     }
-
-    return false;
-}
-
-bool Snake::HasEatenApple(const glm::vec2& applePos) const {
-    return bodyParts.front() == applePos;
 }
 
-void Snake::WrapPosition(glm::vec2& position, const glm::vec2& gridSize) {
-    // Wrap around each axis
-    if (position.x < 0) position.x = gridSize.x - 1;
-    else if (position.x >= gridSize.x) position.x = 0;
-
-    if (position.y < 0) position.y = gridSize.y - 1;
-    else if (position.y >= gridSize.y) position.y = 0;
+void SnakeTable::SetBody(size_t player, const pos* parts, size_t count)
+{
+    if (count > maxLength) count = maxLength;
+    pendingGrowth[player] = 0;
+    headIndices[player] = 0;
+    lengths[player] = static_cast<uint16_t>(count);
+    std::memcpy(bodies.data() + player * maxLength, parts, count * sizeof(pos));
+    if (count > 0) heads[player] = parts[0];
 }
 
-bool Snake::IsOppositeDirection(Direction dir1, Direction dir2) const {
+static bool IsOppositeDirection(Direction dir1, Direction dir2) {
     return (dir1 == Direction::FORWARD && dir2 == Direction::BACKWARD) ||
         (dir1 == Direction::BACKWARD && dir2 == Direction::FORWARD) ||
         (dir1 == Direction::LEFT && dir2 == Direction::RIGHT) ||
@@ -1,41 +1,126 @@
 #pragma once
 
 #include <vector>
-#include <glm.hpp>
-#include <gtc/matrix_transform.hpp>
+#include <iterator>
+#include <cstring>
 
-enum class Direction {
+#include "../misc/game_types.h"
+
+enum class Direction : uint8_t {
     FORWARD,
     BACKWARD,
     LEFT,
     RIGHT,
 };
 
-class Snake {
+// Read-only view over the snake ring buffer, element 0 is the head
+class BodyView {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = pos;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const pos*;
+        using reference = const pos&;
+
+        Iterator(const BodyView* view, size_t index) : view(view), index(index) {}
+
+        reference operator*() const { return (*view)[index]; }
+        pointer operator->() const { return &(*view)[index]; }
+        Iterator& operator++() { ++index; return *this; }
+        Iterator operator++(int) { Iterator tmp = *this; ++index; return tmp; }
+        bool operator==(const Iterator& other) const { return index == other.index; }
+        bool operator!=(const Iterator& other) const { return index != other.index; }
+
+    private:
+        const BodyView* view;
+        size_t index;
+    };
+
+    BodyView(const pos* data, size_t capacity, size_t head, size_t length) :
+        data(data), capacity(capacity), head(head), length(length) {}
+
+    const pos& operator[](size_t i) const
+    {
+        size_t index = head + i;
+        if (index >= capacity) index -= capacity;
+        return data[index];
+    }
+
+    // Copies the body into a contiguous array, at most two memcpy calls
+    void CopyTo(pos* out) const
+    {
+        size_t first = capacity - head < length ? capacity - head : length;
+        std::memcpy(out, data + head, first * sizeof(pos));
+        std::memcpy(out + first, data, (length - first) * sizeof(pos));
+    }
+
+    const pos& front() const { return data[head]; }
+    const pos& back() const { return (*this)[length - 1]; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    Iterator begin() const { return Iterator(this, 0); }
+    Iterator end() const { return Iterator(this, length); }
+
+private:
+    const pos* data;
+    size_t capacity;
+    size_t head;
+    size_t length;
+};
+
+// Every snake of a match, stored field by field. The per-tick passes walk
+// heads, directions and alive flags as flat arrays; each body is a
+// fixed-capacity ring buffer in one shared allocation.
+class SnakeTable {
 public:
-    Snake();
-    ~Snake() = default;
-
-    void Update(const glm::vec2& gridSize);
-    bool SetDirection(Direction dir);
-    void Reset();
-    //void Reset(const glm::vec2& position);
-    void AddBodyPart(const glm::vec2& pos);
-    bool CheckCollision() const;
-    bool HasEatenApple(const glm::vec2& applePos) const;
-    std::vector<glm::vec2>& getBodyParts() { return bodyParts; }
-
-    const std::vector<glm::vec2>& GetBodyParts() const { return bodyParts; }
-    const glm::vec2& GetHeadPosition() const { return bodyParts.front(); }
-    Direction GetCurrentDirection() const { return currentDirection; }
+    SnakeTable(size_t count = 0);
+    ~SnakeTable() = default;
+
+    void Resize(size_t count);
+    void Reset(size_t player);
+    void Kill(size_t player) { alive[player] = 0; }
+
+    void AddBodyPart(size_t player, const pos& part);
+    void SetBody(size_t player, const pos* parts, size_t count);
+    bool SetDirection(size_t player, Direction dir);
+    // Sets the direction without the reversal check, for state from the server
+    void ForceDirection(size_t player, Direction dir);
+    void Grow(size_t player);
+
+    // Moves the head to newHead, see MatchRules::NextHeads. Returns true and
+    // the cell that left the body, or false if the snake grew on this move
+    // and kept its tail.
+    bool Advance(size_t player, const pos& newHead, pos& tail);
+
+    size_t Count() const { return alive.size(); }
+    size_t MaxLength() const { return maxLength; }
+    const pos* Heads() const { return heads.data(); }
+    const Direction* Directions() const { return directions.data(); }
+
+    // The view is invalidated by Advance, AddBodyPart and SetBody
+    BodyView GetBody(size_t player) const { return BodyView(bodies.data() + player * maxLength, maxLength, headIndices[player], lengths[player]); }
+    const pos& GetHead(size_t player) const { return heads[player]; }
+    Direction GetDirection(size_t player) const { return directions[player]; }
+    size_t GetLength(size_t player) const { return lengths[player]; }
+    bool IsAlive(size_t player) const { return alive[player] != 0; }
+
+    // The rest of the per-snake state, so a match can be saved and restored exactly
+    Direction GetLastDirection(size_t player) const { return lastDirections[player]; }
+    uint16_t GetPendingGrowth(size_t player) const { return pendingGrowth[player]; }
+    void SetPendingGrowth(size_t player, uint16_t growth) { pendingGrowth[player] = growth; }
 
 private:
-    std::vector<glm::vec2> bodyParts;
-    Direction currentDirection;
-    Direction lastDirection;
-    glm::vec2 startPosition;
-    bool isAlive;
-
-    void WrapPosition(glm::vec2& position, const glm::vec2& gridSize);
-    bool IsOppositeDirection(Direction dir1, Direction dir2) const;
+    std::vector<pos> heads;
+    std::vector<Direction> directions;
+    std::vector<Direction> lastDirections;
+    std::vector<uint16_t> headIndices;
+    std::vector<uint16_t> lengths;
+    std::vector<uint16_t> pendingGrowth;
+    std::vector<uint8_t> alive;
+    // maxLength slots per player, the body runs from headIndices for lengths elements
+    std::vector<pos> bodies;
+    size_t maxLength;
 };
@@ -0,0 +1,284 @@
+#include "dedicated_server.h"
+#include <iostream>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+
+
+DedicatedServer::DedicatedServer(int gridSizeX, int gridSizeZ, size_t playerCount, size_t maxRooms, size_t maxSpectators) :
+    gridSizeX(gridSizeX),
+    gridSizeZ(gridSizeZ),
+    playerCount(playerCount),
+    maxRooms(maxRooms),
+    maxSpectators(maxSpectators),
+    scheduler(std::chrono::milliseconds(tickIntervalMs))
+{
+}
+
+bool DedicatedServer::Initialize(int& port)
+{
+    size_t peerCount = std::min(maxRooms * playerCount + maxSpectators, maxPeers);
+    if (!networkManager.InitializeServer(port, peerCount)) {
+        return false;
+    }
+    routes.assign(peerCount, Route{});
+    networkManager.onConnectionChange = std::bind(&DedicatedServer::onConnectionChanged, this, std::placeholders::_1, std::placeholders::_2);
+    networkManager.onSpectatorConnect = std::bind(&DedicatedServer::onSpectatorConnected, this, std::placeholders::_1, std::placeholders::_2);
+    networkManager.onSnakeDirChangeReceive = std::bind(&DedicatedServer::onSnakeDirChangeReceived, this, std::placeholders::_1, std::placeholders::_2);
+    networkManager.onSnapshotAckReceive = std::bind(&DedicatedServer::onSnapshotAckReceived, this, std::placeholders::_1, std::placeholders::_2);
+    return true;
+}
+
+bool DedicatedServer::SetStatsFile(const std::string& path)
+{
+    statsFile.open(path, std::ios::app);
+    return statsFile.is_open();
+}
+
+void DedicatedServer::Run()
+{
+#ifdef _WIN32
+    // The default 15.6 ms timer resolution would show up as tick jitter
+    timeBeginPeriod(1);
+#endif
+    running = true;
+    scheduler.Reset();
+    while (running) {
+        WaitForNextTick();
+        uint32_t steps = scheduler.Advance();
+        for (uint32_t i = 0; i < steps; ++i) {
+            Tick();
+            if (scheduler.GetTick() % statsPeriodTicks == 0) {
+                ReportTiming();
+            }
+        }
+    }
+    // Closes the recordings of matches still running
+    rooms.clear();
+    networkManager.Shutdown();
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+}
+
+// Sleeps until just before the deadline and yields for the rest, the OS
+// wakeup alone can be late by a scheduler quantum
+void DedicatedServer::WaitForNextTick()
+{
+    const auto spinMargin = std::chrono::milliseconds(1);
+    auto deadline = scheduler.NextTickTime();
+    std::this_thread::sleep_until(deadline - spinMargin);
+    while (TickScheduler::Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+void DedicatedServer::ReportTiming()
+{
+    const TickStats& stats = scheduler.GetStats();
+    std::cout << "Tick " << scheduler.GetTick()
+        << ": " << activeRooms.size() << " rooms"
+        << ", late mean " << stats.MeanLateNs() / 1000 << " us"
+        << ", max " << stats.maxLateNs / 1000 << " us"
+        << ", dropped " << stats.droppedTicks << std::endl;
+    scheduler.ResetStats();
+
+    // Receive latency includes the wait for the next tick
+    NetworkQueueStats in = networkManager.GetReceiveStats();
+    NetworkQueueStats out = networkManager.GetSendStats();
+    std::cout << "  recv queue: " << in.messages << " msgs, max depth " << in.maxDepth
+        << ", latency mean " << in.MeanLatencyNs() / 1000 << " us, max " << in.maxLatencyNs / 1000 << " us"
+        << ", dropped " << in.dropped << std::endl;
+    std::cout << "  send queue: " << out.messages << " msgs, max depth " << out.maxDepth
+        << ", latency mean " << out.MeanLatencyNs() / 1000 << " us, max " << out.maxLatencyNs / 1000 << " us"
+        << ", dropped " << out.dropped << std::endl;
+    networkManager.ResetQueueStats();
+
+    if (statsFile.is_open()) {
+        writeNetworkStats();
+    }
+}
+
+// One line per connected peer, one per message type, all with the tick they were taken at
+void DedicatedServer::writeNetworkStats()
+{
+    NetworkStats stats = networkManager.GetStats();
+    uint64_t tick = scheduler.GetTick();
+    for (const PeerStats& peer : stats.peers) {
+        statsFile << "{\"tick\":" << tick << ",\"peer\":" << peer.peerId
+            << ",\"room\":" << (routes[peer.peerId].room == noRoom ? -1 : static_cast<int64_t>(routes[peer.peerId].room))
+            << ",\"spectator\":" << (routes[peer.peerId].slot == Route::spectator ? "true" : "false")
+            << ",\"rtt_ms\":" << peer.roundTripTimeMs << ",\"rtt_variance_ms\":" << peer.roundTripTimeVarianceMs
+            << ",\"packet_loss\":" << peer.packetLoss << ",\"reliable_in_flight\":" << peer.reliableInFlight
+            << ",\"retransmits\":" << peer.retransmits
+            << ",\"sent_packets_per_sec\":" << peer.sent.packetsPerSecond << ",\"sent_bytes_per_sec\":" << peer.sent.bytesPerSecond
+            << ",\"received_packets_per_sec\":" << peer.received.packetsPerSecond << ",\"received_bytes_per_sec\":" << peer.received.bytesPerSecond
+            << "}\n";
+    }
+    for (size_t i = 0; i < messageTypeCount; ++i) {
+        statsFile << "{\"tick\":" << tick << ",\"message\":\"" << MessageTypeName(static_cast<MessageType>(i)) << "\""
+            << ",\"sent_packets\":" << stats.sent[i].packets << ",\"sent_bytes\":" << stats.sent[i].bytes
+            << ",\"sent_packets_per_sec\":" << stats.sent[i].packetsPerSecond << ",\"sent_bytes_per_sec\":" << stats.sent[i].bytesPerSecond
+            << ",\"received_packets\":" << stats.received[i].packets << ",\"received_bytes\":" << stats.received[i].bytes
+            << ",\"received_packets_per_sec\":" << stats.received[i].packetsPerSecond << ",\"received_bytes_per_sec\":" << stats.received[i].bytesPerSecond
+            << ",\"dropped\":" << stats.dropped[i] << "}\n";
+    }
+    statsFile << "{\"tick\":" << tick << ",\"peers\":" << stats.peers.size() << ",\"rooms\":" << activeRooms.size()
+        << ",\"send_queue_depth\":" << stats.sendQueueDepth << ",\"receive_queue_depth\":" << stats.receiveQueueDepth << "}\n";
+    statsFile.flush();
+}
+
+void DedicatedServer::Tick()
+{
+    networkManager.Update();
+
+    for (size_t i = 0; i < waitingPeers.size();) {
+        if (placePeer(waitingPeers[i])) {
+            waitingPeers.erase(waitingPeers.begin() + i);
+        }
+        else {
+            ++i;
+        }
+    }
+
+    // Rooms without players are released, so idle rooms cost nothing here
+    for (uint32_t id : activeRooms) {
+        rooms[id]->Tick();
+    }
+    // Everything the rooms sent this tick goes out together
+    networkManager.Flush();
+}
+
+bool DedicatedServer::placePeer(uint32_t peerId)
+{
+    Room* room = nullptr;
+    for (uint32_t id : activeRooms) {
+        if (rooms[id]->CanJoin()) {
+            room = rooms[id].get();
+            break;
+        }
+    }
+
+    if (!room) {
+        room = allocateRoom();
+    }
+    if (!room) {
+        return false;
+    }
+
+    int slot = room->Join(peerId);
+    routes[peerId] = Route{ room->GetId(), static_cast<uint32_t>(slot) };
+    return true;
+}
+
+Room* DedicatedServer::allocateRoom()
+{
+    uint32_t id;
+    if (!freeRoomIds.empty()) {
+        id = freeRoomIds.back();
+        freeRoomIds.pop_back();
+    }
+    else if (rooms.size() < maxRooms) {
+        id = static_cast<uint32_t>(rooms.size());
+        rooms.emplace_back();
+    }
+    else {
+        return nullptr;
+    }
+    rooms[id] = std::make_unique<Room>(id, gridSizeX, gridSizeZ, playerCount, networkManager, replayDirectory);
+    activeRooms.push_back(id);
+    return rooms[id].get();
+}
+
+void DedicatedServer::releaseRoom(uint32_t id)
+{
+    rooms[id].reset();
+    activeRooms.erase(std::find(activeRooms.begin(), activeRooms.end(), id));
+    freeRoomIds.push_back(id);
+}
+
+Room* DedicatedServer::routedRoom(uint32_t peerId) const
+{
+    if (peerId >= routes.size() || routes[peerId].room == noRoom || routes[peerId].slot == Route::spectator) {
+        return nullptr;
+    }
+    return rooms[routes[peerId].room].get();
+}
+
+void DedicatedServer::onConnectionChanged(uint32_t peerId, bool connected)
+{
+    if (peerId >= routes.size()) {
+        return;
+    }
+    if (connected) {
+        if (!placePeer(peerId)) {
+            waitingPeers.push_back(peerId);
+        }
+        return;
+    }
+
+    waitingPeers.erase(std::remove(waitingPeers.begin(), waitingPeers.end(), peerId), waitingPeers.end());
+    Route route = routes[peerId];
+    routes[peerId] = Route{};
+    if (route.room == noRoom) {
+        return;
+    }
+    Room* room = rooms[route.room].get();
+    if (route.slot == Route::spectator) {
+        room->RemoveSpectator(peerId);
+        --spectatorCount;
+    }
+    else {
+        room->Leave(route.slot);
+    }
+    if (room->IsEmpty()) {
+        releaseRoom(route.room);
+    }
+}
+
+void DedicatedServer::onSpectatorConnected(uint32_t peerId, uint32_t roomId)
+{
+    if (peerId >= routes.size()) {
+        return;
+    }
+    if (spectatorCount >= maxSpectators) {
+        std::cerr << "No seat for spectator " << peerId << std::endl;
+        networkManager.RefusePeer(peerId);
+        return;
+    }
+    // The room asked for, else the first one running, else a new one for
+    // players to join
+    Room* room = roomId < rooms.size() ? rooms[roomId].get() : nullptr;
+    if (!room && !activeRooms.empty()) {
+        room = rooms[activeRooms.front()].get();
+    }
+    if (!room) {
+        room = allocateRoom();
+    }
+    if (!room) {
+        std::cerr << "No room for spectator " << peerId << std::endl;
+        networkManager.RefusePeer(peerId);
+        return;
+    }
+    room->AddSpectator(peerId);
+    ++spectatorCount;
+    routes[peerId] = Route{ room->GetId(), Route::spectator };
+}
+
+void DedicatedServer::onSnakeDirChangeReceived(uint32_t peerId, const SnakeDirChangeView& msg)
+{
+    if (Room* room = routedRoom(peerId)) {
+        room->OnSnakeDirChange(routes[peerId].slot, msg);
+    }
+}
+
+void DedicatedServer::onSnapshotAckReceived(uint32_t peerId, const SnapshotAckView& msg)
+{
+    if (Room* room = routedRoom(peerId)) {
+        room->OnSnapshotAck(routes[peerId].slot, msg);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "room.h"
+#include "../network/network_manager.h"
+#include "../misc/tick_scheduler.h"
+
+// Runs matches between remote clients without a window or GL context. All
+// players connect to one port and are put into rooms of playerCount, each
+// with its own match; every room runs on the same tick. Up to maxSpectators
+// more peers can watch a room of their choice, others asking to watch are
+// refused rather than seated as players.
+class DedicatedServer {
+public:
+    DedicatedServer(int gridSizeX, int gridSizeZ, size_t playerCount = 2, size_t maxRooms = 1, size_t maxSpectators = 0);
+    ~DedicatedServer() = default;
+
+    bool Initialize(int& port);
+    // Blocks until Stop is called
+    void Run();
+    void Stop() { running = false; }
+    // Records every match into a replay file in dir
+    void SetReplayDirectory(const std::string& dir) { replayDirectory = dir; }
+    // Appends the network stats of every peer and message type as JSON
+    // lines to path with each timing report, false if it cannot be opened
+    bool SetStatsFile(const std::string& path);
+
+    // ENet numbers its peers with 12 bits
+    static constexpr size_t maxPeers = 4095;
+
+private:
+    static constexpr uint32_t noRoom = UINT32_MAX;
+    // Tick jitter and network queue summary once a minute at the default rate
+    static constexpr uint64_t statsPeriodTicks = 240;
+
+    // Where a peer's messages go
+    struct Route {
+        static constexpr uint32_t spectator = UINT32_MAX;
+
+        uint32_t room = noRoom;
+        uint32_t slot = 0;
+    };
+
+    void Tick();
+    void WaitForNextTick();
+    void ReportTiming();
+    void writeNetworkStats();
+    // Puts the peer into a room that is waiting for players or a new one
+    bool placePeer(uint32_t peerId);
+    // nullptr once maxRooms are in use
+    Room* allocateRoom();
+    void releaseRoom(uint32_t room);
+    // The room of a player, spectators send nothing a room uses
+    Room* routedRoom(uint32_t peerId) const;
+
+    void onConnectionChanged(uint32_t peerId, bool connected);
+    void onSpectatorConnected(uint32_t peerId, uint32_t room);
+    void onSnakeDirChangeReceived(uint32_t peerId, const SnakeDirChangeView& msg);
+    void onSnapshotAckReceived(uint32_t peerId, const SnapshotAckView& msg);
+
+    int gridSizeX;
+    int gridSizeZ;
+    size_t playerCount;
+    size_t maxRooms;
+    size_t maxSpectators;
+    size_t spectatorCount = 0;
+    NetworkManager networkManager;
+    // By room id, only rooms with players are allocated
+    std::vector<std::unique_ptr<Room>> rooms;
+    std::vector<uint32_t> freeRoomIds;
+    // Ids of the allocated rooms, the only ones that are ticked
+    std::vector<uint32_t> activeRooms;
+    // By peer id
+    std::vector<Route> routes;
+    // Connected peers no room had space for yet
+    std::vector<uint32_t> waitingPeers;
+    std::string replayDirectory;
+    std::ofstream statsFile;
+    TickScheduler scheduler;
+    std::atomic<bool> running{ false };
+};
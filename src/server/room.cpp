@@ -0,0 +1,174 @@
+#include "room.h"
+#include <iostream>
+#include <algorithm>
+#include <ctime>
+#include <filesystem>
+#include <random>
+
+Room::Room(uint32_t id, int gridSizeX, int gridSizeZ, size_t playerCount, NetworkManager& networkManager, const std::string& replayDirectory) :
+    id(id),
+    match(gridSizeX, gridSizeZ, playerCount),
+    networkManager(networkManager),
+    replayDirectory(replayDirectory),
+    players(playerCount, noPeer),
+    sender(playerCount)
+{
+}
+
+int Room::Join(uint32_t peerId)
+{
+    if (!CanJoin()) {
+        return -1;
+    }
+    auto slot = std::find(players.begin(), players.end(), noPeer);
+    *slot = peerId;
+    size_t index = static_cast<size_t>(slot - players.begin());
+    sender.ResetSlot(index);
+    ++connectedPlayers;
+    std::cout << "Room " << id << ": player " << index + 1 << " joined" << std::endl;
+    return static_cast<int>(index);
+}
+
+void Room::Leave(size_t slot)
+{
+    if (slot >= players.size() || players[slot] == noPeer) {
+        return;
+    }
+    players[slot] = noPeer;
+    --connectedPlayers;
+    std::cout << "Room " << id << ": player " << slot + 1 << " left" << std::endl;
+
+    // The snake leaves the running match, which may end it
+    if (match.GetState() != GameState::Active) {
+        return;
+    }
+    bool finished = match.Eliminate(slot);
+    replay.RecordEvent(match);
+    if (finished) {
+        finishMatch(match.GetResult());
+    }
+}
+
+void Room::AddSpectator(uint32_t peerId)
+{
+    networkManager.AddToGroup(id, peerId);
+    ++spectators;
+    std::cout << "Room " << id << ": spectator joined, " << spectators << " watching" << std::endl;
+    if (match.GetState() != GameState::Active) {
+        return;
+    }
+    networkManager.sendStartGame(startMessage, peerId);
+    // Deltas of the following ticks are against the newest snapshot
+    const std::vector<uint8_t>& keyframe = sender.FullState();
+    if (!keyframe.empty()) {
+        networkManager.sendGameState(keyframe, peerId, true);
+    }
+}
+
+void Room::RemoveSpectator(uint32_t peerId)
+{
+    networkManager.RemoveFromGroup(peerId);
+    if (spectators > 0) --spectators;
+}
+
+void Room::Tick()
+{
+    if (match.GetState() == GameState::Active) {
+        sender.ApplyInputs(match);
+        replay.RecordTick(match);
+        bool finished = match.Update();
+        sendGameStates(finished);
+        if (finished) {
+            finishMatch(match.GetResult());
+        }
+        return;
+    }
+
+    if (connectedPlayers < players.size()) {
+        return;
+    }
+    if (restartCountdown > 0) {
+        --restartCountdown;
+        return;
+    }
+    startMatch();
+}
+
+void Room::startMatch()
+{
+    // A fresh seed per match, kept in the replay header
+    std::random_device device;
+    uint64_t seed = (static_cast<uint64_t>(device()) << 32) | device();
+    match.Seed(seed);
+    if (!match.Start()) {
+        std::cerr << "The board is too small for " << players.size() << " players" << std::endl;
+        return;
+    }
+
+    sender.Start();
+
+    // Same layout for everyone, only the player id differs
+    FillStartGameMsg(match, spectatorPlayerId, startMessage);
+    if (spectators > 0) {
+        networkManager.sendToGroup(startMessage, id);
+    }
+    messageBuffer = startMessage;
+    for (size_t i = 0; i < players.size(); ++i) {
+        SetStartGamePlayerId(messageBuffer, static_cast<uint8_t>(i));
+        networkManager.sendStartGame(messageBuffer, players[i]);
+    }
+    std::cout << "Room " << id << ": match started" << std::endl;
+
+    ++matchNumber;
+    if (!replayDirectory.empty()) {
+        std::string name = "match-" + std::to_string(std::time(nullptr)) + "-room" + std::to_string(id) + "-" + std::to_string(matchNumber) + ".trr";
+        std::string path = (std::filesystem::path(replayDirectory) / name).string();
+        if (!replay.Open(path.c_str(), match, seed)) {
+            std::cerr << "Could not create replay file " << path << std::endl;
+        }
+    }
+}
+
+void Room::finishMatch(GameResult result)
+{
+    // Only the players of this room get the result
+    StopGameMsg msg;
+    msg.result = result;
+    for (auto peerId : players) {
+        if (peerId != noPeer) networkManager.sendStopGame(msg, peerId);
+    }
+    if (spectators > 0) {
+        EncodeStopGame(msg, messageBuffer);
+        networkManager.sendToGroup(messageBuffer, id);
+    }
+    restartCountdown = restartDelayTicks;
+    replay.Close(result);
+    if (result.IsTie()) {
+        std::cout << "Room " << id << ": match finished, tie" << std::endl;
+    }
+    else {
+        std::cout << "Room " << id << ": match finished, player " << result.winner + 1 << " won" << std::endl;
+    }
+}
+
+void Room::sendGameStates(bool final)
+{
+    sender.PushState(match);
+    for (size_t i = 0; i < players.size(); ++i) {
+        if (players[i] == noPeer) continue;
+        networkManager.sendGameState(sender.StateFor(i), players[i], final);
+    }
+    if (spectators > 0) {
+        networkManager.sendToGroup(sender.StateSincePrevious(), id);
+    }
+}
+
+void Room::OnSnakeDirChange(size_t slot, const SnakeDirChangeView& msg)
+{
+    sender.OnSnakeDirChange(match, slot, msg);
+}
+
+void Room::OnSnapshotAck(size_t slot, const SnapshotAckView& msg)
+{
+    sender.OnSnapshotAck(slot, msg);
+}
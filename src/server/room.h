@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../world/match.h"
+#include "../world/replay.h"
+#include "../network/network_manager.h"
+#include "../network/match_messages.h"
+#include "../network/match_sync.h"
+
+// One match and the players in it. All rooms of a server share its ENet
+// host and its tick; the server routes each peer's messages to its room.
+// Spectators of the room are a NetworkManager group with the room's id:
+// every state is encoded once for all of them, as a delta against the
+// previous one, sent reliably so each of them holds the baseline.
+class Room {
+public:
+    static constexpr uint32_t noPeer = UINT32_MAX;
+    static constexpr int restartDelayTicks = 12;
+
+    // replayDirectory is the server's, empty for no recordings
+    Room(uint32_t id, int gridSizeX, int gridSizeZ, size_t playerCount, NetworkManager& networkManager, const std::string& replayDirectory);
+    Room(const Room&) = delete;
+    Room& operator=(const Room&) = delete;
+
+    // A new match starts once every slot is taken
+    bool CanJoin() const { return connectedPlayers < players.size() && match.GetState() != GameState::Active; }
+    bool IsEmpty() const { return connectedPlayers == 0 && spectators == 0; }
+    uint32_t GetId() const { return id; }
+    bool IsPlaying() const { return match.GetState() == GameState::Active; }
+
+    // Returns the slot the peer got, -1 if it cannot join
+    int Join(uint32_t peerId);
+    void Leave(size_t slot);
+    // A spectator joining a running match gets its start and a keyframe
+    void AddSpectator(uint32_t peerId);
+    void RemoveSpectator(uint32_t peerId);
+    void Tick();
+
+    void OnSnakeDirChange(size_t slot, const SnakeDirChangeView& msg);
+    void OnSnapshotAck(size_t slot, const SnapshotAckView& msg);
+
+private:
+    void startMatch();
+    void finishMatch(GameResult result);
+    // final sends the last state of a match reliably
+    void sendGameStates(bool final);
+
+    uint32_t id;
+    Match match;
+    NetworkManager& networkManager;
+    const std::string& replayDirectory;
+    // Peer id per player slot
+    std::vector<uint32_t> players;
+    size_t connectedPlayers = 0;
+    std::vector<uint8_t> messageBuffer;
+    // Start message of the running match, for spectators joining late
+    std::vector<uint8_t> startMessage;
+    size_t spectators = 0;
+    MatchSender sender;
+    ReplayWriter replay;
+    uint64_t matchNumber = 0;
+    int restartCountdown = 0;
+};
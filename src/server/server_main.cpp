@@ -0,0 +1,101 @@
+#include <iostream>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define GAME_PREF
+#define NETWORK_PREF
+#include "../misc/game_preferences.h"
+
+#include "dedicated_server.h"
+
+DedicatedServer* serverPtr = nullptr;
+
+void on_signal(int)
+{
+    if (serverPtr) serverPtr->Stop();
+}
+
+int main(int argc, char** argv)
+{
+    int port = std::atoi(default_port);
+    int gridSizeX = 20;
+    int gridSizeZ = 20;
+    int playerCount = 2;
+    int roomCount = 1;
+    int spectatorCount = 0;
+    std::string replayDirectory;
+    std::string statsPath;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--grid") == 0 && i + 2 < argc) {
+            gridSizeX = std::atoi(argv[++i]);
+            gridSizeZ = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--players") == 0 && i + 1 < argc) {
+            playerCount = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--rooms") == 0 && i + 1 < argc) {
+            roomCount = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--spectators") == 0 && i + 1 < argc) {
+            spectatorCount = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--replay-dir") == 0 && i + 1 < argc) {
+            replayDirectory = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            statsPath = argv[++i];
+        }
+        else {
+            std::cerr << "usage: trons-server [--port N] [--grid X Z] [--players N] [--rooms N] [--spectators N] [--replay-dir DIR] [--stats-json FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (gridSizeX < 4 || gridSizeZ < 4 || gridSizeX > maxfieldSizeX || gridSizeZ > maxfieldSizeZ) {
+        std::cerr << "grid size must be between 4 and " << maxfieldSizeX << std::endl;
+        return 1;
+    }
+
+    if (playerCount < 1 || playerCount > maxPlayers) {
+        std::cerr << "player count must be between 1 and " << maxPlayers << std::endl;
+        return 1;
+    }
+    if (static_cast<size_t>(playerCount) > MatchRules::SpawnCapacity(gridSizeX, gridSizeZ)) {
+        std::cerr << "a " << gridSizeX << "x" << gridSizeZ << " board fits at most " << MatchRules::SpawnCapacity(gridSizeX, gridSizeZ) << " players" << std::endl;
+        return 1;
+    }
+
+    if (roomCount < 1 || static_cast<size_t>(roomCount) * playerCount > DedicatedServer::maxPeers) {
+        std::cerr << "rooms times players must be between 1 and " << DedicatedServer::maxPeers << std::endl;
+        return 1;
+    }
+
+    if (spectatorCount < 0 || static_cast<size_t>(roomCount) * playerCount + spectatorCount > DedicatedServer::maxPeers) {
+        std::cerr << "rooms times players plus spectators must be at most " << DedicatedServer::maxPeers << std::endl;
+        return 1;
+    }
+
+    DedicatedServer server(gridSizeX, gridSizeZ, static_cast<size_t>(playerCount), static_cast<size_t>(roomCount), static_cast<size_t>(spectatorCount));
+    server.SetReplayDirectory(replayDirectory);
+    if (!statsPath.empty() && !server.SetStatsFile(statsPath)) {
+        std::cerr << "could not open stats file " << statsPath << std::endl;
+        return 1;
+    }
+    if (!server.Initialize(port)) {
+        std::cerr << "could not open a server port" << std::endl;
+        return 1;
+    }
+    std::cout << "trons-server listening on port " << port << std::endl;
+
+    serverPtr = &server;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    server.Run();
+    return 0;
+}
@@ -4,6 +4,12 @@
 #include <sstream>
 #include <iostream>
 #include <gtc/type_ptr.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <filesystem>
+#include <vector>
 
 #include <string>
 #include <fstream>
@@ -15,14 +21,99 @@ Shader::~Shader() {
     glDeleteProgram(ID);
 }
 
-void Shader::linkProgram()
+namespace {
+
+// A cached binary starts with this, its format and its length
+constexpr uint32_t binaryMagic = 0x42535254;
+
+// Program binaries are core only from 4.1, so the 3.3 glad declares none of
+// this and the entry points are looked up by loadBinaryFunctions
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint, GLsizei, GLsizei*, GLenum*, void*);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint, GLenum, const void*, GLsizei);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint, GLenum, GLint);
+
+// All null when the driver has no program binaries
+GetProgramBinaryProc getProgramBinary = nullptr;
+ProgramBinaryProc programBinary = nullptr;
+ProgramParameteriProc programParameteri = nullptr;
+
+bool hasExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const GLubyte* extension = glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i));
+        if (extension && std::strcmp(reinterpret_cast<const char*>(extension), name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// FNV-1a
+uint64_t hashString(uint64_t hash, const std::string& value)
+{
+    for (unsigned char c : value) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    // Keeps "ab" + "c" apart from "a" + "bc"
+    hash ^= 0xFF;
+    return hash * 1099511628211ull;
+}
+
+std::string glString(GLenum name)
+{
+    const GLubyte* value = glGetString(name);
+    return value ? reinterpret_cast<const char*>(value) : "";
+}
+
+}
+
+void Shader::loadBinaryFunctions(GLADloadproc load)
+{
+    getProgramBinary = nullptr;
+    programBinary = nullptr;
+    programParameteri = nullptr;
+
+    GLint major = 0;
+    GLint minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if ((major < 4 || (major == 4 && minor < 1)) && !hasExtension("GL_ARB_get_program_binary")) {
+        return;
+    }
+    // The extension uses the same names as core
+    auto getProgram = reinterpret_cast<GetProgramBinaryProc>(load("glGetProgramBinary"));
+    auto program = reinterpret_cast<ProgramBinaryProc>(load("glProgramBinary"));
+    auto parameter = reinterpret_cast<ProgramParameteriProc>(load("glProgramParameteri"));
+    if (getProgram && program && parameter) {
+        getProgramBinary = getProgram;
+        programBinary = program;
+        programParameteri = parameter;
+    }
+}
+
+bool Shader::linkProgram(bool retrievable)
 {
     //  
     ID = glCreateProgram();
+    if (retrievable && programParameteri) programParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     if (vertexShader) glAttachShader(ID, vertexShader);
     if (fragmentShader) glAttachShader(ID, fragmentShader);
     glLinkProgram(ID);
-    checkCompileErrors(ID, "PROGRAM");
+    bool linked = checkCompileErrors(ID, "PROGRAM");
+    reflect();
 
     //    
     if (vertexShader) {
@@ -33,11 +124,147 @@ void Shader::linkProgram()
         glDeleteShader(fragmentShader);
         fragmentShader = 0;
     }
+    return linked;
+}
+
+bool Shader::loadProgram(const char* vertexPath, const char* fragmentPath, const std::string& cacheDirectory)
+{
+    std::string vertexCode;
+    std::string fragmentCode;
+    if (!readFile(vertexPath, vertexCode) || !readFile(fragmentPath, fragmentCode)) {
+        return false;
+    }
+    if (ID) {
+        glDeleteProgram(ID);
+        ID = 0;
+    }
+
+    GLint formats = 0;
+    if (programBinary) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    std::string cachePath;
+    if (!cacheDirectory.empty() && formats > 0) {
+        // A binary is only valid for the sources and the driver that made it
+        uint64_t key = 14695981039346656037ull;
+        for (const std::string& part : { vertexCode, fragmentCode, glString(GL_VENDOR), glString(GL_RENDERER), glString(GL_VERSION) }) {
+            key = hashString(key, part);
+        }
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+        cachePath = (std::filesystem::path(cacheDirectory) / name).string();
+        if (loadBinary(cachePath)) {
+            reflect();
+            return true;
+        }
+    }
+
+    vertexShader = compileSource(vertexCode, GL_VERTEX_SHADER);
+    fragmentShader = compileSource(fragmentCode, GL_FRAGMENT_SHADER);
+    if (!linkProgram(!cachePath.empty())) {
+        glDeleteProgram(ID);
+        ID = 0;
+        return false;
+    }
+    if (!cachePath.empty()) {
+        saveBinary(cachePath);
+    }
+    return true;
+}
+
+bool Shader::loadBinary(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    std::streamoff size = file.tellg();
+    uint32_t header[3];
+    if (size < static_cast<std::streamoff>(sizeof(header)) || !file.seekg(0)
+        || !file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != binaryMagic) {
+        return false;
+    }
+    // The length must be what follows the header, so a damaged file can
+    // not ask for more memory than it holds
+    if (header[2] == 0 || header[2] > static_cast<uint32_t>(std::numeric_limits<GLsizei>::max())
+        || static_cast<std::streamoff>(header[2]) != size - static_cast<std::streamoff>(sizeof(header))) {
+        return false;
+    }
+    std::vector<char> binary(header[2]);
+    if (!file.read(binary.data(), static_cast<std::streamsize>(binary.size()))) {
+        return false;
+    }
+
+    ID = glCreateProgram();
+    programBinary(ID, header[1], binary.data(), static_cast<GLsizei>(binary.size()));
+    // A driver may still refuse it, then the sources are compiled again
+    GLint success = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(ID);
+        ID = 0;
+        return false;
+    }
+    return true;
+}
+
+void Shader::saveBinary(const std::string& path) const
+{
+    GLint length = 0;
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    std::vector<char> binary(static_cast<size_t>(length));
+    GLsizei written = 0;
+    GLenum format = 0;
+    getProgramBinary(ID, length, &written, &format, binary.data());
+    if (written <= 0) {
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    // Written aside and renamed, so a crash never leaves half a binary under the real name
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        uint32_t header[3] = { binaryMagic, format, static_cast<uint32_t>(written) };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(binary.data(), written);
+        if (!file) {
+            std::cerr << "could not write shader cache " << temporary << std::endl;
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::cerr << "could not write shader cache " << path << ": " << error.message() << std::endl;
+    }
 }
 
 unsigned int Shader::compileShader(const char* path, GLenum shaderType)
 {
     std::string code;
+    if (!readFile(path, code)) {
+        return 0;
+    }
+    return compileSource(code, shaderType);
+}
+
+unsigned int Shader::compileSource(const std::string& code, GLenum shaderType)
+{
+    const char* shaderCode = code.c_str();
+    unsigned int shader = glCreateShader(shaderType);
+    glShaderSource(shader, 1, &shaderCode, NULL);
+    glCompileShader(shader);
+    checkCompileErrors(shader, shaderType == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT");
+
+    return shader;
+}
+
+bool Shader::readFile(const char* path, std::string& out)
+{
     std::ifstream shaderFile;
 
     shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
@@ -47,23 +274,16 @@ unsigned int Shader::compileShader(const char* path, GLenum shaderType)
         std::stringstream shaderStream;
         shaderStream << shaderFile.rdbuf();
         shaderFile.close();
-        code = shaderStream.str();
+        out = shaderStream.str();
     }
     catch (std::ifstream::failure& e) {
         std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
-        return 0;
+        return false;
     }
-
-    const char* shaderCode = code.c_str();
-    unsigned int shader = glCreateShader(shaderType);
-    glShaderSource(shader, 1, &shaderCode, NULL);
-    glCompileShader(shader);
-    checkCompileErrors(shader, shaderType == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT");
-
-    return shader;
+    return true;
 }
 
-void Shader::checkCompileErrors(unsigned int shader, std::string type)
+bool Shader::checkCompileErrors(unsigned int shader, std::string type)
 {
     int success;
     char infoLog[1024];
@@ -81,35 +301,95 @@ void Shader::checkCompileErrors(unsigned int shader, std::string type)
             std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
         }
     }
+    return success != 0;
+}
+
+void Shader::reflect()
+{
+    uniforms.clear();
+    uniformBlocks.clear();
+
+    GLint count = 0;
+    GLint maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::string name(static_cast<size_t>(maxLength > 0 ? maxLength : 1), '\0');
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(ID, static_cast<GLuint>(i), maxLength, &length, &size, &type, &name[0]);
+        std::string uniform(name.data(), static_cast<size_t>(length));
+        // Members of uniform blocks have no location
+        GLint location = glGetUniformLocation(ID, uniform.c_str());
+        if (location < 0) continue;
+        // Arrays are reported as name[0], they are set by their plain name
+        if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0) {
+            uniform.resize(uniform.size() - 3);
+        }
+        uniforms[uniform] = location;
+    }
+
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+    name.assign(static_cast<size_t>(maxLength > 0 ? maxLength : 1), '\0');
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        glGetActiveUniformBlockName(ID, static_cast<GLuint>(i), maxLength, &length, &name[0]);
+        UniformBlock block{ static_cast<GLuint>(i), 0 };
+        glGetActiveUniformBlockiv(ID, block.index, GL_UNIFORM_BLOCK_DATA_SIZE, &block.size);
+        uniformBlocks[std::string(name.data(), static_cast<size_t>(length))] = block;
+    }
+}
+
+GLint Shader::uniformLocation(const std::string& name) const
+{
+    auto it = uniforms.find(name);
+    return it != uniforms.end() ? it->second : -1;
+}
+
+bool Shader::bindUniformBlock(const std::string& name, GLuint binding)
+{
+    auto it = uniformBlocks.find(name);
+    if (it == uniformBlocks.end()) {
+        return false;
+    }
+    glUniformBlockBinding(ID, it->second.index, binding);
+    return true;
 }
 
-void Shader::setBool(const std::string& name, bool value) const 
+GLint Shader::uniformBlockSize(const std::string& name) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    auto it = uniformBlocks.find(name);
+    return it != uniformBlocks.end() ? it->second.size : 0;
 }
 
-void Shader::setInt(const std::string& name, int value) const 
+void Shader::setBool(GLint location, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(location, (int)value);
 }
 
-void Shader::setFloat(const std::string& name, float value) const
+void Shader::setInt(GLint location, int value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(location, value);
 }
 
-void Shader::setVec3(const std::string& name, const glm::vec3& value) const
+void Shader::setFloat(GLint location, float value) const
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+    glUniform1f(location, value);
 }
 
-void Shader::setVec4(const std::string& name, const glm::vec4& value) const 
+void Shader::setVec3(GLint location, const glm::vec3& value) const
 {
-    glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+    glUniform3fv(location, 1, glm::value_ptr(value));
 }
 
-void Shader::setMat4(const std::string& name, const glm::mat4& mat) const
+void Shader::setVec4(GLint location, const glm::vec4& value) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+    glUniform4fv(location, 1, glm::value_ptr(value));
 }
 
+void Shader::setMat4(GLint location, const glm::mat4& mat) const
+{
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
+}
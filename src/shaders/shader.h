@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include <glm.hpp>
 
 #include <string>
@@ -26,7 +27,18 @@ public:
         fragmentShader = compileShader(fragmentPath, GL_FRAGMENT_SHADER);
     }
 
-    void linkProgram();
+    // Links the program and records its active uniforms and uniform blocks.
+    // retrievable asks the driver to keep the binary for glGetProgramBinary.
+    bool linkProgram(bool retrievable = false);
+    // Looks up the program binary entry points the 3.3 glad leaves out,
+    // through the loader glad was given. Call once the context is current;
+    // without it, or without driver support, loadProgram never caches.
+    static void loadBinaryFunctions(GLADloadproc load);
+    // Builds the program from both files, through a binary cached in
+    // cacheDirectory when the driver supports it; an empty directory
+    // always compiles. Replaces any program loaded before.
+    bool loadProgram(const char* vertexPath, const char* fragmentPath, const std::string& cacheDirectory);
+    bool isLoaded() const { return ID != 0; }
 
     void use() 
     {
@@ -34,18 +46,49 @@ public:
     }
 
 public:
-    void setBool(const std::string& name, bool value) const;
-    void setInt(const std::string& name, int value) const;
-    void setFloat(const std::string& name, float value) const;
-    void setVec3(const std::string& name, const glm::vec3& value) const;
-    void setVec4(const std::string& name, const glm::vec4& value) const;
-    void setMat4(const std::string& name, const glm::mat4& mat) const;
+    // Location of an active uniform, -1 if the program has none by that
+    // name. Look it up once and set it by location every frame.
+    GLint uniformLocation(const std::string& name) const;
+    // Connects a uniform block to a UniformBuffer binding point, false if
+    // the program has no such block
+    bool bindUniformBlock(const std::string& name, GLuint binding);
+    // Size the linker gave the block, 0 if there is none
+    GLint uniformBlockSize(const std::string& name) const;
+
+    void setBool(GLint location, bool value) const;
+    void setInt(GLint location, int value) const;
+    void setFloat(GLint location, float value) const;
+    void setVec3(GLint location, const glm::vec3& value) const;
+    void setVec4(GLint location, const glm::vec4& value) const;
+    void setMat4(GLint location, const glm::mat4& mat) const;
+
+    void setBool(const std::string& name, bool value) const { setBool(uniformLocation(name), value); }
+    void setInt(const std::string& name, int value) const { setInt(uniformLocation(name), value); }
+    void setFloat(const std::string& name, float value) const { setFloat(uniformLocation(name), value); }
+    void setVec3(const std::string& name, const glm::vec3& value) const { setVec3(uniformLocation(name), value); }
+    void setVec4(const std::string& name, const glm::vec4& value) const { setVec4(uniformLocation(name), value); }
+    void setMat4(const std::string& name, const glm::mat4& mat) const { setMat4(uniformLocation(name), mat); }
 
 private:
+    struct UniformBlock
+    {
+        GLuint index;
+        GLint size;
+    };
+
     unsigned int vertexShader;
     unsigned int fragmentShader;
+    std::unordered_map<std::string, GLint> uniforms;
+    std::unordered_map<std::string, UniformBlock> uniformBlocks;
+
+    void reflect();
 
     unsigned int compileShader(const char* path, GLenum shaderType);
+    unsigned int compileSource(const std::string& code, GLenum shaderType);
+    static bool readFile(const char* path, std::string& out);
+    bool loadBinary(const std::string& path);
+    void saveBinary(const std::string& path) const;
 
-    void checkCompileErrors(unsigned int shader, std::string type);
+    // Returns false on a failed compile or link
+    bool checkCompileErrors(unsigned int shader, std::string type);
 };
@@ -0,0 +1,22 @@
+#include "uniform_buffer.h"
+
+UniformBuffer::~UniformBuffer()
+{
+    glDeleteBuffers(1, &ID);
+}
+
+void UniformBuffer::create(GLsizeiptr size, GLuint binding)
+{
+    this->size = size;
+    this->binding = binding;
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+}
+
+void UniformBuffer::update(const void* data)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+}
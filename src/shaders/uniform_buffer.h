@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glm.hpp>
+#include <glad/glad.h>
+
+// Values every draw of a frame shares, the std140 layout of the Frame
+// block in the shaders. vec3 values are padded to vec4 as std140 does.
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 lightPos;
+    glm::vec4 lightColor;
+    glm::vec4 viewPos;
+};
+
+// A uniform buffer on a fixed binding point. Programs attach their blocks
+// to the binding with Shader::bindUniformBlock and all of them see each
+// update.
+class UniformBuffer {
+public:
+    UniformBuffer() : ID(0), binding(0), size(0) {}
+    ~UniformBuffer();
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    void create(GLsizeiptr size, GLuint binding);
+    // Replaces the whole contents
+    void update(const void* data);
+
+    GLuint getBinding() const { return binding; }
+    GLsizeiptr getSize() const { return size; }
+
+private:
+    unsigned int ID;
+    GLuint binding;
+    GLsizeiptr size;
+};
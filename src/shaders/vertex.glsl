@@ -1,16 +1,28 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+// Per instance: where the cube sits, its size along each axis and its color
+layout (location = 2) in vec3 aOffset;
+layout (location = 3) in vec3 aScale;
+layout (location = 4) in vec3 aColor;
 
 out vec3 FragPos;
 out vec3 Normal;
+out vec3 Color;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Updated once per frame, see FrameUniforms
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;
+    vec4 lightColor;
+    vec4 viewPos;
+};
 
 void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    FragPos = aPos * aScale + aOffset;
+    // The inverse transpose of a scale is the reciprocal scale
+    Normal = aNormal / aScale;
+    Color = aColor;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
 }
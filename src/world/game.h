@@ -1,12 +1,17 @@
 #pragma once
 
+#include <vector>
 #include <glm.hpp>
-#include <random>
 
-#include "../objects/snake.h"
+#include "match.h"
+#include "replay.h"
+#include "snake_interpolator.h"
 #include "../network/network_manager.h"
+#include "../network/match_messages.h"
+#include "../network/match_sync.h"
 #include "camera.h"
 #include "../misc/game_types.h"
+#include "../misc/tick_scheduler.h"
 
 extern bool lastRender;
 
@@ -15,33 +20,43 @@ public:
     Game(int gridSizeX = 10, int gridSizeZ = 10);
     ~Game() = default;
 
-    void Update(float deltaTime);
-    void ProcessInput(int key);
+    // Runs the simulation ticks that are due, call once per frame
+    void Update();
+    void ProcessInput(Direction dir);
     void Reset();
     void ServerGameStart();
-    void GameStart(glm::vec2* snake1_body, glm::vec2* snake2_body, glm::vec2 apple_pos);
-
-    const Snake& GetSnake() const { return snake1; }
-    const Snake& GetSnake2() const { return snake2; }
-    const glm::vec2& GetApplePosition() const { return applePosition; }
-    const glm::vec2& GetGridSize() const { return gridSize; }
+    // Plays a recorded match instead of a live one, input is ignored
+    bool StartReplay(const char* path);
+
+    const SnakeTable& GetSnakes() const { return view().GetSnakes(); }
+    // Body cells to draw this frame, in between the last ticks
+    const InterpolatedSnakes& GetRenderSnakes();
+    std::chrono::nanoseconds GetInterpolationDelay() const { return interpolator.GetDelay(); }
+    // Index of the snake this side controls, the host is always 0
+    size_t GetLocalPlayer() const { return localPlayer; }
+    const pos& GetApplePosition() const { return view().GetApplePosition(); }
+    const pos& GetGridSize() const { return view().GetGridSize(); }
     const Camera& GetCamera() const { return camera; }
     bool IsGameOver() const { return gameOver; }
+    bool IsReplaying() const { return replaying; }
+    const PredictionStats& GetPredictionStats() const { return receiver.GetPrediction().GetStats(); }
+    NetworkStats GetNetworkStats() const { return networkManager.GetStats(); }
+    bool IsNetworked() const { return !replaying && networkManager.IsConnected(); }
     void SetGridSize(int gridSizeX, int gridSizeZ)
     {
         camera = Camera(50.0f, glm::vec3((gridSizeX - 1) / 2, 25, gridSizeX + 7), glm::vec3((gridSizeX - 1) / 2, 0.0f, (gridSizeZ - 1) / 2));
-        gridSize = glm::vec2(gridSizeX, gridSizeZ);
-        xDist = std::uniform_real_distribution<float>(0, gridSizeX - 1);
-        zDist = std::uniform_real_distribution<float>(0, gridSizeZ - 1);
+        match.SetGridSize(gridSizeX, gridSizeZ);
     }
     void shutDownConnection()
     {
         networkManager.Shutdown();
     }
-    void initializeClient(int port, const char* address);
+    // A spectator watches a match on a dedicated server without playing
+    void initializeClient(int port, const char* address, bool spectate = false);
+    bool IsSpectating() const { return spectating; }
     void initializeServer(int& port);
 
-    GameState getState() { return state; }
+    GameState getState() { return match.GetState(); }
 
     bool isServer() { return networkManager.IsServer(); }
 
@@ -51,36 +66,37 @@ public:
     void (*onGameOver)(GameResult result);
 
 private:
-    void sendGameStateMsg();
-    void spawnApple();
-    glm::vec2 getAccessibleApplePos();
-    bool IsValidApplePosition(const glm::vec2& pos) const;
-    bool CheckSnakesCollision(GameResult& res) const;
+    // The client draws its prediction while a match runs
+    const Match& view() const { return receiver.IsPredicting() ? receiver.GetPrediction().GetMatch() : match; }
+    void sendGameStateMsg(bool final);
 
     void onConnectionChanged(bool Connected);
-    void onStartGameReceived(StartGameMsg* msg);
-    void onGameStateReceived(GameStateMsg* msg);
-    void onStopGameReceived(StopGameMsg* msg);
-    void onSnakeDirChangeReceived(SnakeDirChangeMsg* msg);
+    void onStartGameReceived(const StartGameView& msg);
+    void onGameStateReceived(const GameStateView& msg);
+    void onStopGameReceived(const StopGameView& msg);
+    void onSnakeDirChangeReceived(const SnakeDirChangeView& msg);
+    void onSnapshotAckReceived(const SnapshotAckView& msg);
 
     //void processNetwork();
 
-    Snake snake1; 
-    Snake snake2; 
     Camera camera;
-    glm::vec2 applePosition;
-    glm::vec2 gridSize;
+    // Host: the match. Client: the newest state from the server.
+    Match match;
+    size_t localPlayer = 0;
+    bool spectating = false;
+    std::vector<uint8_t> messageBuffer;
+    // Host: the states and turns of the client snake
+    MatchSender sender;
+    // Client: the states from the server and the prediction
+    MatchReceiver receiver;
     bool gameOver = false;
-    float updateTimer;
-    float updateInterval; 
+    TickScheduler scheduler;
+    SnakeInterpolator interpolator;
+    InterpolatedSnakes renderSnakes;
+    ReplayReader replay;
+    bool replaying = false;
 
     GameResult result;
-    GameState state;
-
-    std::random_device rd;
-    std::mt19937 gen;
-    std::uniform_real_distribution<float> xDist;
-    std::uniform_real_distribution<float> zDist;
 
     NetworkManager networkManager;
 };
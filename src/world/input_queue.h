@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "match.h"
+
+// Turns of one remote player, tagged with the match tick they were made on.
+// A turn is held until the match reaches its tick, so it lands on the same
+// tick the client predicted it on; a late one is applied on the next tick.
+class InputQueue {
+public:
+    static constexpr size_t capacity = 16;
+    // Turns further ahead than this are taken as made now
+    static constexpr uint32_t maxLead = 64;
+
+    void Clear() { count = 0; }
+
+    // Returns false if the queue is full
+    bool Push(uint32_t tick, Direction dir, uint32_t currentTick)
+    {
+        if (count == capacity) return false;
+        if (tick > currentTick + maxLead) tick = currentTick;
+        // Sorted by tick, turns of the same tick keep their order
+        size_t at = count;
+        while (at > 0 && entries[at - 1].tick > tick) {
+            entries[at] = entries[at - 1];
+            --at;
+        }
+        entries[at] = Entry{ tick, dir };
+        ++count;
+        return true;
+    }
+
+    // Applies the turns due at the current tick, call right before match.Update()
+    void Apply(Match& match, size_t player)
+    {
+        size_t due = 0;
+        while (due < count && entries[due].tick <= match.GetTick()) {
+            match.SetDirection(player, entries[due].dir);
+            ++due;
+        }
+        for (size_t i = due; i < count; ++i) {
+            entries[i - due] = entries[i];
+        }
+        count -= due;
+    }
+
+private:
+    struct Entry {
+        uint32_t tick;
+        Direction dir;
+    };
+
+    Entry entries[capacity];
+    size_t count = 0;
+};
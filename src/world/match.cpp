@@ -0,0 +1,268 @@
+#include "match.h"
+#include <algorithm>
+#include <cstring>
+
+#define GAME_PREF
+#include "../misc/game_preferences.h"
+
+Match::Match(int gridSizeX, int gridSizeZ, size_t playerCount, uint64_t seed) :
+    gridSize{ static_cast<uint8_t>(gridSizeX), static_cast<uint8_t>(gridSizeZ) },
+    rng(seed)
+{
+    occupancy.Resize(gridSizeX, gridSizeZ);
+    SetPlayerCount(playerCount);
+}
+
+void Match::SetGridSize(int gridSizeX, int gridSizeZ)
+{
+    gridSize = pos{ static_cast<uint8_t>(gridSizeX), static_cast<uint8_t>(gridSizeZ) };
+    occupancy.Resize(gridSizeX, gridSizeZ);
+}
+
+void Match::SetPlayerCount(size_t playerCount)
+{
+    snakes.Resize(playerCount);
+    nextHeads.resize(playerCount);
+    eliminated.resize(playerCount);
+    state = GameState::NonActive;
+}
+
+bool Match::Start()
+{
+    std::vector<pos> bodies(snakes.Count() * MatchRules::spawnLength);
+    if (!MatchRules::SpawnLayout(gridSize, snakes.Count(), bodies.data())) {
+        return false;
+    }
+
+    // The apple is placed once the bodies are on the board
+    Start(bodies.data(), MatchRules::spawnLength, pos{ 0, 0 });
+    MatchBoard b = board();
+    MatchRules::SpawnApple(b, rng, apple);
+    return true;
+}
+
+void Match::Start(const pos* bodies, size_t bodyLength, pos apple_pos)
+{
+    MatchBoard b = board();
+    MatchRules::PlaceBodies(b, bodies, bodyLength);
+
+    SetApplePosition(apple_pos);
+    result = GameResult{};
+    state = GameState::Active;
+    tick = 0;
+}
+
+bool Match::Update()
+{
+    if (state != GameState::Active) return false;
+
+    MatchBoard b = board();
+    MatchRules::NextHeads(snakes.Heads(), snakes.Directions(), snakes.Count(), gridSize, nextHeads.data());
+    TickOutcome outcome = MatchRules::Tick(b, nextHeads.data(), rng, apple, eliminated.data());
+    ++tick;
+    if (outcome.finished) {
+        Finish(outcome.result);
+        return true;
+    }
+    return false;
+}
+
+bool Match::Eliminate(size_t player)
+{
+    if (state != GameState::Active || player >= snakes.Count() || !snakes.IsAlive(player)) {
+        return false;
+    }
+    MatchBoard b = board();
+    MatchRules::Eliminate(b, player);
+
+    GameResult res;
+    if (MatchRules::IsFinished(b, res)) {
+        Finish(res);
+        return true;
+    }
+    return false;
+}
+
+bool Match::SetDirection(size_t player, Direction dir)
+{
+    if (player >= snakes.Count()) return false;
+    return snakes.SetDirection(player, dir);
+}
+
+void Match::SetSnakeState(size_t player, const pos* parts, size_t count, Direction dir, bool alive)
+{
+    MatchBoard b = board();
+    MatchRules::ReleaseBody(b, player);
+    snakes.Reset(player);
+    snakes.SetBody(player, parts, count);
+    snakes.ForceDirection(player, dir);
+    if (!alive) {
+        // Dead snakes are still drawn but no longer block the board
+        snakes.Kill(player);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        occupancy.Occupy(parts[i], MatchRules::OwnerId(player));
+    }
+}
+
+void Match::Finish(GameResult res)
+{
+    result = res;
+    state = GameState::Pause;
+}
+
+template <typename T>
+static void put(std::vector<uint8_t>& out, const T& value)
+{
+    size_t at = out.size();
+    out.resize(at + sizeof(T));
+    std::memcpy(out.data() + at, &value, sizeof(T));
+}
+
+template <typename T>
+static bool take(const uint8_t*& data, const uint8_t* end, T& value)
+{
+    if (static_cast<size_t>(end - data) < sizeof(T)) return false;
+    std::memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+}
+
+void Match::SaveState(std::vector<uint8_t>& out) const
+{
+    put(out, gridSize);
+    put(out, static_cast<uint8_t>(snakes.Count()));
+    put(out, state);
+    put(out, result);
+    put(out, tick);
+    put(out, apple.cell);
+    put(out, static_cast<uint8_t>(apple.placed));
+    put(out, rng.GetState());
+
+    for (size_t p = 0; p < snakes.Count(); ++p) {
+        put(out, static_cast<uint16_t>(snakes.GetLength(p)));
+        put(out, snakes.GetPendingGrowth(p));
+        put(out, snakes.GetDirection(p));
+        put(out, snakes.GetLastDirection(p));
+        put(out, static_cast<uint8_t>(snakes.IsAlive(p)));
+        size_t at = out.size();
+        out.resize(at + snakes.GetLength(p) * sizeof(pos));
+        snakes.GetBody(p).CopyTo(reinterpret_cast<pos*>(out.data() + at));
+    }
+
+    size_t cellCount = static_cast<size_t>(gridSize.x) * static_cast<size_t>(gridSize.z);
+    out.insert(out.end(), occupancy.Cells(), occupancy.Cells() + cellCount);
+    uint32_t freeCount = static_cast<uint32_t>(occupancy.FreeCount());
+    put(out, freeCount);
+    size_t at = out.size();
+    out.resize(at + freeCount * sizeof(uint32_t));
+    std::memcpy(out.data() + at, occupancy.FreeCells(), freeCount * sizeof(uint32_t));
+}
+
+bool Match::LoadState(const uint8_t* data, size_t size)
+{
+    // Everything is read and checked before the match is touched, the data
+    // may come from a damaged replay file
+    const uint8_t* end = data + size;
+    pos loadedSize;
+    uint8_t playerCount;
+    GameState loadedState;
+    GameResult loadedResult;
+    uint32_t loadedTick;
+    pos appleCell;
+    uint8_t applePlaced;
+    uint64_t rngState;
+    if (!take(data, end, loadedSize) || !take(data, end, playerCount) || !take(data, end, loadedState) ||
+        !take(data, end, loadedResult) || !take(data, end, loadedTick) || !take(data, end, appleCell) || !take(data, end, applePlaced) ||
+        !take(data, end, rngState)) {
+        return false;
+    }
+    if (loadedSize.x == 0 || loadedSize.z == 0 || playerCount == 0 || playerCount > maxPlayers || loadedState > GameState::Active ||
+        (!loadedResult.IsTie() && loadedResult.winner >= playerCount)) {
+        return false;
+    }
+    auto onBoard = [&](const pos& cell) { return cell.x < loadedSize.x && cell.z < loadedSize.z; };
+    if (applePlaced && !onBoard(appleCell)) {
+        return false;
+    }
+
+    struct LoadedSnake
+    {
+        uint16_t length;
+        uint16_t growth;
+        Direction dir;
+        Direction lastDir;
+        uint8_t isAlive;
+        const pos* body;
+    };
+    std::vector<LoadedSnake> loaded(playerCount);
+    for (LoadedSnake& snake : loaded) {
+        if (!take(data, end, snake.length) || !take(data, end, snake.growth) || !take(data, end, snake.dir) ||
+            !take(data, end, snake.lastDir) || !take(data, end, snake.isAlive)) {
+            return false;
+        }
+        if (snake.length > snakes.MaxLength() || snake.dir > Direction::RIGHT || snake.lastDir > Direction::RIGHT ||
+            static_cast<size_t>(end - data) < snake.length * sizeof(pos)) {
+            return false;
+        }
+        snake.body = reinterpret_cast<const pos*>(data);
+        data += snake.length * sizeof(pos);
+        if (!std::all_of(snake.body, snake.body + snake.length, onBoard)) {
+            return false;
+        }
+    }
+
+    size_t cellCount = static_cast<size_t>(loadedSize.x) * static_cast<size_t>(loadedSize.z);
+    if (static_cast<size_t>(end - data) < cellCount) {
+        return false;
+    }
+    const uint8_t* cells = data;
+    data += cellCount;
+    uint32_t freeCount;
+    if (!take(data, end, freeCount) || static_cast<size_t>(end - data) < freeCount * sizeof(uint32_t)) {
+        return false;
+    }
+
+    // The owner grid has to be exactly what the live bodies cover: dead
+    // snakes have left the board and no two live cells overlap
+    std::vector<uint8_t> expected(cellCount, OccupancyGrid::Empty);
+    for (size_t p = 0; p < playerCount; ++p) {
+        if (!loaded[p].isAlive) continue;
+        for (size_t i = 0; i < loaded[p].length; ++i) {
+            const pos& cell = loaded[p].body[i];
+            uint8_t& owner = expected[static_cast<size_t>(cell.z) * loadedSize.x + cell.x];
+            if (owner != OccupancyGrid::Empty) {
+                return false;
+            }
+            owner = MatchRules::OwnerId(p);
+        }
+    }
+    if (!std::equal(expected.begin(), expected.end(), cells)) {
+        return false;
+    }
+    OccupancyGrid loadedOccupancy(loadedSize.x, loadedSize.z);
+    if (!loadedOccupancy.Restore(cells, data, freeCount)) {
+        return false;
+    }
+
+    gridSize = loadedSize;
+    occupancy = std::move(loadedOccupancy);
+    SetPlayerCount(playerCount);
+    for (size_t p = 0; p < playerCount; ++p) {
+        const LoadedSnake& snake = loaded[p];
+        snakes.Reset(p);
+        snakes.SetBody(p, snake.body, snake.length);
+        snakes.ForceDirection(p, snake.lastDir);
+        snakes.SetDirection(p, snake.dir);
+        snakes.SetPendingGrowth(p, snake.growth);
+        if (!snake.isAlive) snakes.Kill(p);
+    }
+    apple.cell = appleCell;
+    apple.placed = applePlaced != 0;
+    rng.SetState(rngState);
+    result = loadedResult;
+    state = loadedState;
+    tick = loadedTick;
+    return true;
+}
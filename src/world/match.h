@@ -0,0 +1,82 @@
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include "../objects/snake.h"
+#include "occupancy_grid.h"
+#include "match_rules.h"
+#include "../misc/rng.h"
+#include "../misc/game_types.h"
+
+// Rules and state of a single match. Has no rendering, input or network
+// dependencies, so it runs the same in the client and in trons-server.
+class Match {
+public:
+    Match(int gridSizeX = 10, int gridSizeZ = 10, size_t playerCount = 2, uint64_t seed = std::random_device{}());
+    ~Match() = default;
+
+    void SetGridSize(int gridSizeX, int gridSizeZ);
+    void SetPlayerCount(size_t playerCount);
+    void Seed(uint64_t seed) { rng.Seed(seed); }
+
+    // Server side start: default spawn points and a random apple.
+    // Returns false if the players do not fit on the board.
+    bool Start();
+    // Start from a known layout, e.g. one received from the server.
+    // bodies holds bodyLength cells per player, in player order.
+    void Start(const pos* bodies, size_t bodyLength, pos apple_pos);
+
+    // Advances one tick, returns true if the match ended on this tick
+    bool Update();
+    // Takes a player out, e.g. on disconnect. Returns true if that ended the match.
+    bool Eliminate(size_t player);
+
+    // Connection changes move the match out of Active
+    void Pause() { state = GameState::Pause; }
+    void Stop() { state = GameState::NonActive; }
+
+    bool SetDirection(size_t player, Direction dir);
+    // Overwrites a snake with state received from the server
+    void SetSnakeState(size_t player, const pos* parts, size_t count, Direction dir, bool alive);
+    void SetApplePosition(pos apple_pos) { apple.cell = apple_pos; apple.placed = true; }
+
+    // Appends the complete match state to out, including the rng and the
+    // free-cell order, so a loaded match runs on exactly like the saved one
+    void SaveState(std::vector<uint8_t>& out) const;
+    // Returns false and leaves the match as it was if the data is invalid:
+    // cut short, cells off the board, more than maxPlayers snakes or an
+    // owner grid that does not match the bodies
+    bool LoadState(const uint8_t* data, size_t size);
+
+    const SnakeTable& GetSnakes() const { return snakes; }
+    size_t GetPlayerCount() const { return snakes.Count(); }
+    const pos& GetApplePosition() const { return apple.cell; }
+    // False while the board is too full for an apple
+    bool IsApplePlaced() const { return apple.placed; }
+    const pos& GetGridSize() const { return gridSize; }
+    GameResult GetResult() const { return result; }
+    GameState GetState() const { return state; }
+    // Ticks run since Start
+    uint32_t GetTick() const { return tick; }
+    // For state received from the server
+    void SetTick(uint32_t t) { tick = t; }
+
+private:
+    MatchBoard board() { return MatchBoard{ snakes, 0, snakes.Count(), occupancy.View(), gridSize }; }
+    void Finish(GameResult res);
+
+    SnakeTable snakes;
+    OccupancyGrid occupancy;
+    Apple apple;
+    pos gridSize;
+    // Per-tick scratch for the rules
+    std::vector<pos> nextHeads;
+    std::vector<size_t> eliminated;
+
+    GameResult result;
+    GameState state = GameState::NonActive;
+    uint32_t tick = 0;
+
+    Rng rng;
+};
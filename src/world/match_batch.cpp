@@ -0,0 +1,101 @@
+#include "match_batch.h"
+
+MatchBatch::MatchBatch(size_t matchCount, size_t playersPerMatch, int gridSizeX, int gridSizeZ, uint64_t seed) :
+    matchCount(matchCount),
+    playersPerMatch(playersPerMatch),
+    gridSize{ static_cast<uint8_t>(gridSizeX), static_cast<uint8_t>(gridSizeZ) },
+    cellCount(static_cast<size_t>(gridSizeX) * static_cast<size_t>(gridSizeZ)),
+    snakes(matchCount * playersPerMatch),
+    cells(matchCount * cellCount),
+    freeCells(matchCount * cellCount),
+    freeSlots(matchCount * cellCount),
+    freeCounts(matchCount),
+    apples(matchCount),
+    rngs(matchCount),
+    terminal(matchCount),
+    results(matchCount),
+    ticks(matchCount),
+    rewards(matchCount * playersPerMatch),
+    nextHeads(matchCount * playersPerMatch),
+    eliminated(playersPerMatch)
+{
+    spawnBodies.resize(playersPerMatch * MatchRules::spawnLength);
+    if (!MatchRules::SpawnLayout(gridSize, playersPerMatch, spawnBodies.data())) {
+        spawnBodies.clear();
+        return;
+    }
+
+    for (size_t m = 0; m < matchCount; ++m) {
+        rngs[m].Seed(seed + m);
+    }
+    ResetAll();
+}
+
+MatchBoard MatchBatch::board(size_t match)
+{
+    size_t offset = match * cellCount;
+    OccupancyView grid(cells.data() + offset, freeCells.data() + offset, freeSlots.data() + offset, freeCounts[match], gridSize.x, gridSize.z);
+    return MatchBoard{ snakes, match * playersPerMatch, playersPerMatch, grid, gridSize };
+}
+
+void MatchBatch::Reset(size_t match)
+{
+    if (!IsValid()) return;
+
+    MatchBoard b = board(match);
+    MatchRules::PlaceBodies(b, spawnBodies.data(), MatchRules::spawnLength);
+    MatchRules::SpawnApple(b, rngs[match], apples[match]);
+
+    if (terminal[match]) --terminalCount;
+    terminal[match] = 0;
+    results[match] = GameResult{};
+    ticks[match] = 0;
+}
+
+void MatchBatch::ResetAll()
+{
+    for (size_t m = 0; m < matchCount; ++m) {
+        Reset(m);
+    }
+}
+
+void MatchBatch::StepAll(const uint8_t* inputs)
+{
+    if (!IsValid()) return;
+
+    size_t slots = snakes.Count();
+    for (size_t i = 0; i < slots; ++i) {
+        rewards[i] = 0.0f;
+        if (inputs[i] <= static_cast<uint8_t>(Direction::RIGHT)) {
+            snakes.SetDirection(i, static_cast<Direction>(inputs[i]));
+        }
+    }
+
+    // One pass over every snake of every match, finished matches included
+    // since their heads are simply never used
+    MatchRules::NextHeads(snakes.Heads(), snakes.Directions(), slots, gridSize, nextHeads.data());
+
+    for (size_t m = 0; m < matchCount; ++m) {
+        if (terminal[m]) continue;
+
+        MatchBoard b = board(m);
+        TickOutcome outcome = MatchRules::Tick(b, nextHeads.data() + b.first, rngs[m], apples[m], eliminated.data());
+        ++ticks[m];
+
+        float* reward = rewards.data() + b.first;
+        for (size_t k = 0; k < outcome.eliminatedCount; ++k) {
+            reward[eliminated[k]] += deathReward;
+        }
+        if (outcome.eater < playersPerMatch) {
+            reward[outcome.eater] += appleReward;
+        }
+        if (outcome.finished) {
+            terminal[m] = 1;
+            ++terminalCount;
+            results[m] = outcome.result;
+            if (!outcome.result.IsTie()) {
+                reward[outcome.result.winner] += winReward;
+            }
+        }
+    }
+}
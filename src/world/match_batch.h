@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "../objects/snake.h"
+#include "match_rules.h"
+#include "../misc/rng.h"
+#include "../misc/game_types.h"
+
+// Steps many independent matches at once, for bots and self-play. All
+// matches share one board size and player count. Snakes, boards, apples and
+// generators live in flat arrays indexed by match, and every tick goes
+// through the same MatchRules as Match, so a batch match seeded with
+// seed + index plays exactly like Match(gridSizeX, gridSizeZ, players, seed + index).
+//
+// Player slots are numbered match * playersPerMatch + player.
+class MatchBatch {
+public:
+    static constexpr uint8_t noInput = UINT8_MAX;
+    static constexpr float appleReward = 1.0f;
+    static constexpr float deathReward = -1.0f;
+    static constexpr float winReward = 1.0f;
+
+    MatchBatch(size_t matchCount, size_t playersPerMatch, int gridSizeX, int gridSizeZ, uint64_t seed = 0);
+    ~MatchBatch() = default;
+
+    // The players do not fit on the board, see MatchRules::SpawnCapacity
+    bool IsValid() const { return !spawnBodies.empty(); }
+
+    // Restarts a match on the default spawn layout, the generator keeps running
+    void Reset(size_t match);
+    void ResetAll();
+
+    // inputs holds a Direction value per player slot, anything else (noInput)
+    // keeps the current direction. Finished matches are skipped until reset.
+    void StepAll(const uint8_t* inputs);
+
+    size_t GetMatchCount() const { return matchCount; }
+    size_t GetPlayersPerMatch() const { return playersPerMatch; }
+    const pos& GetGridSize() const { return gridSize; }
+
+    bool IsTerminal(size_t match) const { return terminal[match] != 0; }
+    GameResult GetResult(size_t match) const { return results[match]; }
+    uint32_t GetTick(size_t match) const { return ticks[match]; }
+    size_t GetTerminalCount() const { return terminalCount; }
+
+    // Per player slot reward of the last StepAll: apples eaten, deaths and wins
+    const float* GetRewards() const { return rewards.data(); }
+    const SnakeTable& GetSnakes() const { return snakes; }
+    const pos& GetApplePosition(size_t match) const { return apples[match].cell; }
+
+private:
+    MatchBoard board(size_t match);
+
+    size_t matchCount;
+    size_t playersPerMatch;
+    pos gridSize;
+    size_t cellCount;
+
+    SnakeTable snakes;
+    // cellCount entries per match, see OccupancyView
+    std::vector<uint8_t> cells;
+    std::vector<uint32_t> freeCells;
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> freeCounts;
+
+    std::vector<Apple> apples;
+    std::vector<Rng> rngs;
+    std::vector<uint8_t> terminal;
+    std::vector<GameResult> results;
+    std::vector<uint32_t> ticks;
+    std::vector<float> rewards;
+    size_t terminalCount = 0;
+
+    // Per-tick scratch for the rules and the spawn layout shared by every match
+    std::vector<pos> nextHeads;
+    std::vector<size_t> eliminated;
+    std::vector<pos> spawnBodies;
+};
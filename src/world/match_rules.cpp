@@ -0,0 +1,183 @@
+#include "match_rules.h"
+#include <algorithm>
+
+namespace MatchRules {
+
+size_t SpawnCapacity(int gridSizeX, int gridSizeZ)
+{
+    // One lane every other column, spawnLength cells and a gap per snake in a lane
+    return static_cast<size_t>(gridSizeX / 2) * static_cast<size_t>(gridSizeZ / (spawnLength + 1));
+}
+
+bool SpawnLayout(const pos& gridSize, size_t count, pos* bodies)
+{
+    if (count == 0 || count > SpawnCapacity(gridSize.x, gridSize.z)) {
+        return false;
+    }
+
+    // Snakes start as vertical lines heading forward, spread over the lanes
+    // and stacked with a one cell gap when there are more snakes than lanes.
+    // Snakes in a lane move in step, so the start itself never collides.
+    size_t lanes = std::min(count, static_cast<size_t>(gridSize.x / 2));
+    size_t rows = (count + lanes - 1) / lanes;
+    size_t top = (gridSize.z - rows * (spawnLength + 1)) / 2;
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t lane = i % lanes;
+        size_t row = i / lanes;
+        uint8_t x = static_cast<uint8_t>((2 * lane + 1) * gridSize.x / (2 * lanes));
+        for (size_t k = 0; k < spawnLength; ++k) {
+            bodies[i * spawnLength + k] = pos{ x, static_cast<uint8_t>(top + row * (spawnLength + 1) + k) };
+        }
+    }
+    return true;
+}
+
+void PlaceBodies(MatchBoard& board, const pos* bodies, size_t bodyLength)
+{
+    board.grid.Clear();
+    for (size_t p = 0; p < board.count; ++p) {
+        size_t i = board.first + p;
+        board.snakes.Reset(i);
+        for (size_t k = 0; k < bodyLength; ++k) {
+            const pos& part = bodies[p * bodyLength + k];
+            board.snakes.AddBodyPart(i, part);
+            board.grid.Occupy(part, OwnerId(p));
+        }
+    }
+}
+
+void SpawnApple(MatchBoard& board, Rng& rng, Apple& apple)
+{
+    apple.placed = board.grid.SampleFree(rng, apple.cell);
+}
+
+void NextHeads(const pos* heads, const Direction* dirs, size_t count, const pos& gridSize, pos* out)
+{
+    const int sizeX = gridSize.x;
+    const int sizeZ = gridSize.z;
+    for (size_t i = 0; i < count; ++i) {
+        // FORWARD/BACKWARD move along z and LEFT/RIGHT along x, the low bit
+        // of the direction picks the sign
+        int dir = static_cast<int>(dirs[i]);
+        int sign = ((dir & 1) << 1) - 1;
+        int alongX = dir >> 1;
+        int x = heads[i].x + alongX * sign;
+        int z = heads[i].z + (1 - alongX) * sign;
+
+        // Wrap around each axis
+        x += (x < 0) * sizeX;
+        x -= (x >= sizeX) * sizeX;
+        z += (z < 0) * sizeZ;
+        z -= (z >= sizeZ) * sizeZ;
+
+        out[i].x = static_cast<uint8_t>(x);
+        out[i].z = static_cast<uint8_t>(z);
+    }
+}
+
+TickOutcome Tick(MatchBoard& board, const pos* nextHeads, Rng& rng, Apple& apple, size_t* eliminated)
+{
+    SnakeTable& snakes = board.snakes;
+    TickOutcome outcome;
+    outcome.eater = board.count;
+
+    // Every tail is retired before any head lands, so a head may take a cell
+    // that a tail left on this same tick
+    for (size_t p = 0; p < board.count; ++p) {
+        size_t i = board.first + p;
+        if (!snakes.IsAlive(i)) continue;
+        pos tail;
+        if (snakes.Advance(i, nextHeads[p], tail)) {
+            board.grid.Release(tail, OwnerId(p));
+        }
+    }
+
+    // Single pass over the heads. A free cell is claimed by the head; a
+    // claimed cell kills the snake, and if the owner's head landed there on
+    // this tick too it is a head-on crash and both die.
+    for (size_t p = 0; p < board.count; ++p) {
+        size_t i = board.first + p;
+        if (!snakes.IsAlive(i)) continue;
+        const pos& head = snakes.GetHead(i);
+        uint8_t owner = board.grid.Get(head);
+        if (owner == OccupancyView::Empty) {
+            board.grid.Occupy(head, OwnerId(p));
+            continue;
+        }
+        snakes.Kill(i);
+        eliminated[outcome.eliminatedCount++] = p;
+
+        size_t other = owner - 1;
+        if (other != p && snakes.IsAlive(board.first + other) && snakes.GetHead(board.first + other) == head) {
+            snakes.Kill(board.first + other);
+            eliminated[outcome.eliminatedCount++] = other;
+        }
+    }
+
+    // Deaths are simultaneous: bodies only leave the board once every head was checked
+    for (size_t k = 0; k < outcome.eliminatedCount; ++k) {
+        ReleaseBody(board, eliminated[k]);
+    }
+
+    if (IsFinished(board, outcome.result)) {
+        outcome.finished = true;
+        return outcome;
+    }
+
+    if (!apple.placed) {
+        // The board was full last time, retry once cells free up
+        SpawnApple(board, rng, apple);
+        return outcome;
+    }
+    for (size_t p = 0; p < board.count; ++p) {
+        size_t i = board.first + p;
+        if (snakes.IsAlive(i) && snakes.GetHead(i) == apple.cell) {
+            snakes.Grow(i);
+            SpawnApple(board, rng, apple);
+            outcome.eater = p;
+            break;
+        }
+    }
+    return outcome;
+}
+
+void Eliminate(MatchBoard& board, size_t player)
+{
+    board.snakes.Kill(board.first + player);
+    ReleaseBody(board, player);
+}
+
+void ReleaseBody(MatchBoard& board, size_t player)
+{
+    // Cells another snake has claimed since are left alone
+    for (const auto& part : board.snakes.GetBody(board.first + player)) {
+        board.grid.Release(part, OwnerId(player));
+    }
+}
+
+bool IsFinished(const MatchBoard& board, GameResult& res)
+{
+    size_t aliveCount = 0;
+    size_t last = 0;
+    for (size_t p = 0; p < board.count; ++p) {
+        if (board.snakes.IsAlive(board.first + p)) {
+            ++aliveCount;
+            last = p;
+        }
+    }
+
+    // A solo match runs until its snake dies, otherwise until one is left
+    size_t minAlive = board.count > 1 ? 1 : 0;
+    if (aliveCount > minAlive) {
+        return false;
+    }
+
+    res = GameResult{};
+    if (aliveCount == 1) {
+        res.winner = static_cast<uint8_t>(last);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+
+#include "../objects/snake.h"
+#include "occupancy_grid.h"
+#include "../misc/rng.h"
+#include "../misc/game_types.h"
+
+// One match as the rules see it: players [first, first + count) of a
+// SnakeTable and one board. Owner ids on the board are 1 + the player index
+// within the match. Match and MatchBatch both step through these functions,
+// so they play exactly the same game.
+struct MatchBoard
+{
+    SnakeTable& snakes;
+    size_t first;
+    size_t count;
+    OccupancyView grid;
+    pos gridSize;
+};
+
+struct Apple
+{
+    pos cell{ 0, 0 };
+    bool placed = false;
+};
+
+struct TickOutcome
+{
+    // Players that died on this tick are the first eliminatedCount entries
+    // of the eliminated array passed to Tick
+    size_t eliminatedCount = 0;
+    // Player that ate the apple, or the player count if nobody did
+    size_t eater = 0;
+    bool finished = false;
+    GameResult result;
+};
+
+namespace MatchRules {
+
+constexpr size_t spawnLength = 3;
+
+inline uint8_t OwnerId(size_t player) { return static_cast<uint8_t>(player + 1); }
+
+// How many snakes the default spawn layout fits on a board
+size_t SpawnCapacity(int gridSizeX, int gridSizeZ);
+// Writes spawnLength cells per player, returns false if they do not fit
+bool SpawnLayout(const pos& gridSize, size_t count, pos* bodies);
+
+// Resets the snakes and the board and places bodyLength cells per player
+void PlaceBodies(MatchBoard& board, const pos* bodies, size_t bodyLength);
+void SpawnApple(MatchBoard& board, Rng& rng, Apple& apple);
+
+// Next head cell for count snakes, wrapping at the board edge. Branch-free,
+// so the batch loop over every snake of every match vectorizes.
+void NextHeads(const pos* heads, const Direction* dirs, size_t count, const pos& gridSize, pos* out);
+
+// Advances the match by one tick. nextHeads holds one entry per player of
+// the board, eliminated must have room for board.count entries.
+TickOutcome Tick(MatchBoard& board, const pos* nextHeads, Rng& rng, Apple& apple, size_t* eliminated);
+
+// Takes a live player out of the match and frees its cells
+void Eliminate(MatchBoard& board, size_t player);
+void ReleaseBody(MatchBoard& board, size_t player);
+
+// True once at most one snake is left (none for a solo match), res gets the winner
+bool IsFinished(const MatchBoard& board, GameResult& res);
+
+}
@@ -0,0 +1,72 @@
+#include "occupancy_grid.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+void OccupancyView::Clear()
+{
+    size_t count = static_cast<size_t>(sizeX) * static_cast<size_t>(sizeZ);
+    std::fill(cells, cells + count, Empty);
+    std::iota(freeCells, freeCells + count, 0u);
+    std::iota(freeSlots, freeSlots + count, 0u);
+    freeCount = static_cast<uint32_t>(count);
+}
+
+bool OccupancyView::SampleFree(Rng& rng, pos& cell) const
+{
+    if (freeCount == 0) {
+        return false;
+    }
+    cell = CellAt(freeCells[rng.Below(freeCount)]);
+    return true;
+}
+
+size_t OccupancyView::SampleFree(Rng& rng, pos* out, size_t count)
+{
+    // Partial Fisher-Yates over the dense array: the picks are swapped to the
+    // front, which reorders the free set without changing its contents
+    size_t found = std::min(count, static_cast<size_t>(freeCount));
+    for (size_t i = 0; i < found; ++i) {
+        size_t j = i + rng.Below(freeCount - static_cast<uint32_t>(i));
+        std::swap(freeCells[i], freeCells[j]);
+        freeSlots[freeCells[i]] = static_cast<uint32_t>(i);
+        freeSlots[freeCells[j]] = static_cast<uint32_t>(j);
+        out[i] = CellAt(freeCells[i]);
+    }
+    return found;
+}
+
+OccupancyGrid::OccupancyGrid(int sizeX, int sizeZ) : freeCount(0), sizeX(0), sizeZ(0)
+{
+    Resize(sizeX, sizeZ);
+}
+
+void OccupancyGrid::Resize(int _sizeX, int _sizeZ)
+{
+    sizeX = _sizeX;
+    sizeZ = _sizeZ;
+    cells.resize(static_cast<size_t>(sizeX) * static_cast<size_t>(sizeZ));
+    freeCells.resize(cells.size());
+    freeSlots.resize(cells.size());
+    Clear();
+}
+
+bool OccupancyGrid::Restore(const uint8_t* _cells, const void* _freeCells, uint32_t _freeCount)
+{
+    if (_freeCount > cells.size() || static_cast<size_t>(std::count(_cells, _cells + cells.size(), Empty)) != _freeCount) {
+        return false;
+    }
+    std::memcpy(freeCells.data(), _freeCells, _freeCount * sizeof(uint32_t));
+    std::fill(freeSlots.begin(), freeSlots.end(), UINT32_MAX);
+    for (uint32_t i = 0; i < _freeCount; ++i) {
+        uint32_t index = freeCells[i];
+        if (index >= cells.size() || _cells[index] != Empty || freeSlots[index] != UINT32_MAX) {
+            Clear();
+            return false;
+        }
+        freeSlots[index] = i;
+    }
+    std::copy(_cells, _cells + cells.size(), cells.begin());
+    freeCount = _freeCount;
+    return true;
+}
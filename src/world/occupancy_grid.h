@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "../misc/game_types.h"
+#include "../misc/rng.h"
+
+// One owner-id byte per board cell, kept up to date as snakes move.
+// Free cells are also kept in a dense array with per-cell back-pointers,
+// so a uniformly random free cell is a single draw.
+//
+// The view does not own its storage, so a batch of matches can keep every
+// board in shared flat arrays; OccupancyGrid below owns one board.
+class OccupancyView {
+public:
+    static constexpr uint8_t Empty = 0;
+
+    OccupancyView(uint8_t* cells, uint32_t* freeCells, uint32_t* freeSlots, uint32_t& freeCount, int sizeX, int sizeZ) :
+        cells(cells), freeCells(freeCells), freeSlots(freeSlots), freeCount(freeCount), sizeX(sizeX), sizeZ(sizeZ) {}
+
+    void Clear();
+
+    uint8_t Get(const pos& cell) const { return cells[Index(cell)]; }
+    bool IsFree(const pos& cell) const { return cells[Index(cell)] == Empty; }
+    size_t FreeCount() const { return freeCount; }
+
+    void Occupy(const pos& cell, uint8_t owner)
+    {
+        uint32_t index = Index(cell);
+        if (cells[index] == Empty) RemoveFree(index);
+        cells[index] = owner;
+    }
+
+    // Only frees the cell if it still belongs to owner
+    void Release(const pos& cell, uint8_t owner)
+    {
+        uint32_t index = Index(cell);
+        if (cells[index] != owner || owner == Empty) return;
+        cells[index] = Empty;
+        AddFree(index);
+    }
+
+    // Returns false when the board has no free cell
+    bool SampleFree(Rng& rng, pos& cell) const;
+    // Picks up to count distinct free cells, returns how many were found
+    size_t SampleFree(Rng& rng, pos* cells, size_t count);
+
+private:
+    static constexpr uint32_t NotFree = UINT32_MAX;
+
+    uint32_t Index(const pos& cell) const
+    {
+        return static_cast<uint32_t>(cell.z) * static_cast<uint32_t>(sizeX) + cell.x;
+    }
+
+    pos CellAt(uint32_t index) const
+    {
+        return pos{ static_cast<uint8_t>(index % static_cast<uint32_t>(sizeX)), static_cast<uint8_t>(index / static_cast<uint32_t>(sizeX)) };
+    }
+
+    void AddFree(uint32_t index)
+    {
+        freeSlots[index] = freeCount;
+        freeCells[freeCount++] = index;
+    }
+
+    void RemoveFree(uint32_t index)
+    {
+        uint32_t slot = freeSlots[index];
+        uint32_t last = freeCells[--freeCount];
+        freeCells[slot] = last;
+        freeSlots[last] = slot;
+        freeSlots[index] = NotFree;
+    }
+
+    uint8_t* cells;
+    uint32_t* freeCells;
+    uint32_t* freeSlots;
+    uint32_t& freeCount;
+    int sizeX;
+    int sizeZ;
+};
+
+class OccupancyGrid {
+public:
+    static constexpr uint8_t Empty = OccupancyView::Empty;
+
+    OccupancyGrid(int sizeX = 0, int sizeZ = 0);
+    ~OccupancyGrid() = default;
+
+    void Resize(int sizeX, int sizeZ);
+    void Clear() { View().Clear(); }
+
+    // Valid until the next Resize
+    OccupancyView View() { return OccupancyView(cells.data(), freeCells.data(), freeSlots.data(), freeCount, sizeX, sizeZ); }
+
+    uint8_t Get(const pos& cell) const { return cells[static_cast<size_t>(cell.z) * static_cast<size_t>(sizeX) + cell.x]; }
+    bool IsFree(const pos& cell) const { return Get(cell) == Empty; }
+    size_t FreeCount() const { return freeCount; }
+
+    void Occupy(const pos& cell, uint8_t owner) { View().Occupy(cell, owner); }
+    void Release(const pos& cell, uint8_t owner) { View().Release(cell, owner); }
+
+    bool SampleFree(Rng& rng, pos& cell) { return View().SampleFree(rng, cell); }
+    size_t SampleFree(Rng& rng, pos* out, size_t count) { return View().SampleFree(rng, out, count); }
+
+    // Raw board and free-cell order. The order decides where apples spawn, so
+    // a saved match has to restore it as is.
+    const uint8_t* Cells() const { return cells.data(); }
+    const uint32_t* FreeCells() const { return freeCells.data(); }
+    // freeCells holds freeCount uint32 indices and need not be aligned.
+    // Returns false if the arrays do not describe a board of the current size.
+    bool Restore(const uint8_t* cells, const void* freeCells, uint32_t freeCount);
+
+private:
+    std::vector<uint8_t> cells;
+    std::vector<uint32_t> freeCells;
+    std::vector<uint32_t> freeSlots;
+    uint32_t freeCount;
+    int sizeX;
+    int sizeZ;
+};
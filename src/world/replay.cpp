@@ -0,0 +1,377 @@
+#include "replay.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static size_t padded(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static size_t rowStride(size_t playerCount)
+{
+    return (playerCount * 2 + 7) / 8;
+}
+
+bool ReplayWriter::Open(const char* path, const Match& match, uint64_t seed, uint32_t _keyframeInterval)
+{
+    Close();
+    file = std::fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    ReplayHeader header{};
+    header.magic = replayMagic;
+    header.version = replayVersion;
+    header.gridSizeX = match.GetGridSize().x;
+    header.gridSizeZ = match.GetGridSize().z;
+    header.playerCount = static_cast<uint8_t>(match.GetPlayerCount());
+    header.keyframeInterval = _keyframeInterval > 0 ? _keyframeInterval : defaultKeyframeInterval;
+    header.seed = seed;
+    header.startTime = static_cast<uint64_t>(std::time(nullptr));
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    offset = sizeof(header);
+    tick = 0;
+    keyframeInterval = header.keyframeInterval;
+    playerCount = match.GetPlayerCount();
+    stride = rowStride(playerCount);
+    inputs.assign(stride * inputBlockTicks, 0);
+    bufferedTicks = 0;
+    chunkOffsets.clear();
+
+    writeKeyframe(match, 0);
+    std::fflush(file);
+    return true;
+}
+
+void ReplayWriter::RecordTick(const Match& match)
+{
+    if (!file) return;
+
+    if (tick > 0 && tick % keyframeInterval == 0) {
+        flushInputs();
+        writeKeyframe(match, 0);
+    }
+
+    uint8_t* row = inputs.data() + bufferedTicks * stride;
+    std::memset(row, 0, stride);
+    const Direction* directions = match.GetSnakes().Directions();
+    for (size_t p = 0; p < playerCount; ++p) {
+        row[p / 4] |= static_cast<uint8_t>(static_cast<uint8_t>(directions[p]) << ((p % 4) * 2));
+    }
+    ++tick;
+    if (++bufferedTicks == inputBlockTicks) {
+        flushInputs();
+    }
+}
+
+void ReplayWriter::RecordEvent(const Match& match)
+{
+    if (!file) return;
+    flushInputs();
+    writeKeyframe(match, replayEventKeyframe);
+    std::fflush(file);
+}
+
+void ReplayWriter::Close(GameResult result)
+{
+    if (!file) return;
+    flushInputs();
+
+    ReplayIndex index{};
+    index.chunkCount = chunkOffsets.size();
+    index.result = result;
+    ReplayTrailer trailer{ offset, replayMagic, 0 };
+    writeChunk(ReplayChunkType::Index, 0, tick, &index, sizeof(index), chunkOffsets.data(), chunkOffsets.size() * sizeof(uint64_t));
+    std::fwrite(&trailer, sizeof(trailer), 1, file);
+
+    std::fclose(file);
+    file = nullptr;
+}
+
+void ReplayWriter::writeChunk(ReplayChunkType type, uint16_t flags, uint64_t chunkTick, const void* payload, size_t size, const void* extra, size_t extraSize)
+{
+    static const uint8_t zeros[8] = {};
+
+    if (type != ReplayChunkType::Index) chunkOffsets.push_back(offset);
+
+    ReplayChunk chunk{ type, flags, static_cast<uint32_t>(size + extraSize), chunkTick };
+    std::fwrite(&chunk, sizeof(chunk), 1, file);
+    std::fwrite(payload, 1, size, file);
+    if (extraSize > 0) std::fwrite(extra, 1, extraSize, file);
+    size_t padding = padded(size + extraSize) - (size + extraSize);
+    std::fwrite(zeros, 1, padding, file);
+    offset += sizeof(chunk) + padded(size + extraSize);
+}
+
+void ReplayWriter::writeKeyframe(const Match& match, uint16_t flags)
+{
+    stateBuffer.clear();
+    match.SaveState(stateBuffer);
+    writeChunk(ReplayChunkType::Keyframe, flags, tick, stateBuffer.data(), stateBuffer.size());
+}
+
+void ReplayWriter::flushInputs()
+{
+    if (bufferedTicks == 0) return;
+    ReplayInputs block{ bufferedTicks, 0 };
+    writeChunk(ReplayChunkType::Inputs, 0, tick - bufferedTicks, &block, sizeof(block), inputs.data(), bufferedTicks * stride);
+    bufferedTicks = 0;
+    std::fflush(file);
+}
+
+bool ReplayReader::Open(const char* path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(ReplayHeader))) {
+        CloseHandle(handle);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(handle);
+        return false;
+    }
+    fileHandle = handle;
+    mappingHandle = mapping;
+    size = static_cast<size_t>(fileSize.QuadPart);
+    data = static_cast<const uint8_t*>(view);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(ReplayHeader))) {
+        close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    size = static_cast<size_t>(info.st_size);
+    data = static_cast<const uint8_t*>(view);
+#endif
+
+    const ReplayHeader& header = GetHeader();
+    if (header.magic != replayMagic || header.version != replayVersion || header.playerCount == 0 ||
+        header.gridSizeX == 0 || header.gridSizeZ == 0) {
+        Close();
+        return false;
+    }
+    stride = rowStride(header.playerCount);
+
+    if (!readIndex() && !scanChunks()) {
+        Close();
+        return false;
+    }
+    tick = 0;
+    blockCursor = 0;
+    keyframeCursor = 0;
+    return true;
+}
+
+void ReplayReader::Close()
+{
+    if (data) {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = nullptr;
+#else
+        munmap(const_cast<uint8_t*>(data), size);
+#endif
+    }
+    data = nullptr;
+    size = 0;
+    blocks.clear();
+    keyframes.clear();
+    tickCount = 0;
+    result = GameResult{};
+    complete = false;
+}
+
+bool ReplayReader::readIndex()
+{
+    // Closed recordings are padded to 8 bytes, anything else was cut short
+    if (size < sizeof(ReplayHeader) + sizeof(ReplayTrailer) || size % 8 != 0) {
+        return false;
+    }
+    const ReplayTrailer* trailer = reinterpret_cast<const ReplayTrailer*>(data + size - sizeof(ReplayTrailer));
+    uint64_t indexOffset = trailer->indexOffset;
+    if (trailer->magic != replayMagic || indexOffset % 8 != 0 || indexOffset < sizeof(ReplayHeader) ||
+        indexOffset > size - sizeof(ReplayTrailer) - sizeof(ReplayChunk) - sizeof(ReplayIndex)) {
+        return false;
+    }
+
+    const ReplayChunk* chunk = reinterpret_cast<const ReplayChunk*>(data + indexOffset);
+    const ReplayIndex* index = reinterpret_cast<const ReplayIndex*>(chunk + 1);
+    size_t available = size - sizeof(ReplayTrailer) - indexOffset - sizeof(ReplayChunk) - sizeof(ReplayIndex);
+    if (chunk->type != ReplayChunkType::Index || index->chunkCount > available / sizeof(uint64_t)) {
+        return false;
+    }
+
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(index + 1);
+    for (uint64_t i = 0; i < index->chunkCount; ++i) {
+        if (!addChunk(offsets[i])) {
+            blocks.clear();
+            keyframes.clear();
+            return false;
+        }
+    }
+    uint64_t recorded = blocks.empty() ? 0 : blocks.back().firstTick + blocks.back().tickCount;
+    if (keyframes.empty() || keyframes.front().tick != 0 || recorded != chunk->tick) {
+        blocks.clear();
+        keyframes.clear();
+        return false;
+    }
+    tickCount = chunk->tick;
+    result = index->result;
+    complete = true;
+    return true;
+}
+
+bool ReplayReader::scanChunks()
+{
+    uint64_t chunkOffset = sizeof(ReplayHeader);
+    while (chunkOffset + sizeof(ReplayChunk) <= size) {
+        const ReplayChunk* chunk = reinterpret_cast<const ReplayChunk*>(data + chunkOffset);
+        // A cut off recording ends in a partial chunk, everything before it is usable
+        if (chunk->type == ReplayChunkType::Index || !addChunk(chunkOffset)) {
+            break;
+        }
+        chunkOffset += sizeof(ReplayChunk) + padded(chunk->size);
+    }
+    if (keyframes.empty() || keyframes.front().tick != 0) {
+        return false;
+    }
+    tickCount = blocks.empty() ? 0 : blocks.back().firstTick + blocks.back().tickCount;
+    result = GameResult{};
+    return true;
+}
+
+bool ReplayReader::addChunk(uint64_t chunkOffset)
+{
+    if (chunkOffset % 8 != 0 || chunkOffset < sizeof(ReplayHeader) || chunkOffset > size - sizeof(ReplayChunk)) {
+        return false;
+    }
+    const ReplayChunk* chunk = reinterpret_cast<const ReplayChunk*>(data + chunkOffset);
+    const uint8_t* payload = reinterpret_cast<const uint8_t*>(chunk + 1);
+    if (chunk->size > size - chunkOffset - sizeof(ReplayChunk)) {
+        return false;
+    }
+
+    uint64_t recorded = blocks.empty() ? 0 : blocks.back().firstTick + blocks.back().tickCount;
+    switch (chunk->type) {
+        case ReplayChunkType::Inputs:
+        {
+            const ReplayInputs* block = reinterpret_cast<const ReplayInputs*>(payload);
+            if (chunk->size < sizeof(ReplayInputs) || chunk->tick != recorded ||
+                block->tickCount > (chunk->size - sizeof(ReplayInputs)) / stride) {
+                return false;
+            }
+            blocks.push_back(InputBlock{ chunk->tick, block->tickCount, payload + sizeof(ReplayInputs) });
+            return true;
+        }
+        case ReplayChunkType::Keyframe:
+        {
+            if (chunk->tick != recorded) {
+                return false;
+            }
+            keyframes.push_back(Keyframe{ chunk->tick, (chunk->flags & replayEventKeyframe) != 0, payload, chunk->size });
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool ReplayReader::Seek(Match& match, uint64_t target)
+{
+    if (!data || target > tickCount) {
+        return false;
+    }
+
+    // Last keyframe at or before target, events come after the periodic
+    // keyframe of the same tick
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), target,
+        [](uint64_t t, const Keyframe& keyframe) { return t < keyframe.tick; });
+    const Keyframe& keyframe = *(next - 1);
+    if (!match.LoadState(keyframe.state, keyframe.size)) {
+        return false;
+    }
+    tick = keyframe.tick;
+    keyframeCursor = static_cast<size_t>(next - keyframes.begin());
+    blockCursor = 0;
+
+    while (tick < target) {
+        if (!Step(match)) return false;
+    }
+    if (tick < tickCount) applyInputs(match);
+    return true;
+}
+
+bool ReplayReader::Step(Match& match)
+{
+    if (tick >= tickCount || !applyInputs(match)) {
+        return false;
+    }
+    match.Update();
+    ++tick;
+    applyEvents(match);
+    return true;
+}
+
+bool ReplayReader::applyInputs(Match& match)
+{
+    while (blockCursor < blocks.size() && blocks[blockCursor].firstTick + blocks[blockCursor].tickCount <= tick) {
+        ++blockCursor;
+    }
+    if (blockCursor == blocks.size() || blocks[blockCursor].firstTick > tick) {
+        return false;
+    }
+
+    const InputBlock& block = blocks[blockCursor];
+    const uint8_t* row = block.rows + (tick - block.firstTick) * stride;
+    size_t playerCount = GetHeader().playerCount;
+    for (size_t p = 0; p < playerCount; ++p) {
+        match.SetDirection(p, static_cast<Direction>((row[p / 4] >> ((p % 4) * 2)) & 3));
+    }
+    return true;
+}
+
+void ReplayReader::applyEvents(Match& match)
+{
+    while (keyframeCursor < keyframes.size() && keyframes[keyframeCursor].tick <= tick) {
+        const Keyframe& keyframe = keyframes[keyframeCursor++];
+        if (keyframe.tick == tick && keyframe.event) {
+            match.LoadState(keyframe.state, keyframe.size);
+        }
+    }
+}
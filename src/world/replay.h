@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "match.h"
+#include "../misc/game_types.h"
+
+// Match recordings. A file is a ReplayHeader followed by chunks, each a
+// ReplayChunk header and a payload padded to 8 bytes. Everything is little
+// endian and aligned, so a reader can work straight from a memory mapping.
+//
+//   inputs    the direction every snake moved with, 2 bits per player per tick
+//   keyframe  Match::SaveState taken before the tick in the chunk header
+//   index     offsets of all chunks and the result, written on Close
+//
+// The file is only ever appended to. A recording cut short, e.g. by a
+// server crash, has no index and is indexed by scanning the chunks.
+
+constexpr uint32_t replayMagic = 0x31525254; // "TRR1"
+constexpr uint16_t replayVersion = 2;
+
+struct ReplayHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t gridSizeX;
+    uint8_t gridSizeZ;
+    uint8_t playerCount;
+    uint8_t reserved[3];
+    uint32_t keyframeInterval;
+    uint64_t seed;
+    // Unix time in seconds
+    uint64_t startTime;
+};
+
+enum class ReplayChunkType : uint16_t {
+    Inputs = 1,
+    Keyframe = 2,
+    Index = 3,
+};
+
+struct ReplayChunk {
+    ReplayChunkType type;
+    // Keyframe: state was changed outside a tick and the reader has to load it
+    uint16_t flags;
+    // Payload bytes, without the padding
+    uint32_t size;
+    // First tick of an inputs chunk, tick of a keyframe, tick count for the index
+    uint64_t tick;
+};
+
+constexpr uint16_t replayEventKeyframe = 1;
+
+// Payload of an inputs chunk, followed by tickCount rows of packed directions
+struct ReplayInputs {
+    uint32_t tickCount;
+    uint32_t reserved;
+};
+
+// Payload of the index chunk, followed by chunkCount file offsets
+struct ReplayIndex {
+    uint64_t chunkCount;
+    GameResult result;
+    uint8_t reserved[7];
+};
+
+// Last 16 bytes of a closed recording
+struct ReplayTrailer {
+    uint64_t indexOffset;
+    uint32_t magic;
+    uint32_t reserved;
+};
+
+class ReplayWriter {
+public:
+    static constexpr uint32_t defaultKeyframeInterval = 64;
+    // Inputs are buffered and written this many ticks at a time
+    static constexpr uint32_t inputBlockTicks = 16;
+
+    ReplayWriter() = default;
+    ~ReplayWriter() { Close(); }
+    ReplayWriter(const ReplayWriter&) = delete;
+    ReplayWriter& operator=(const ReplayWriter&) = delete;
+
+    // Starts a recording of a match that was just started
+    bool Open(const char* path, const Match& match, uint64_t seed, uint32_t keyframeInterval = defaultKeyframeInterval);
+    // Call right before match.Update()
+    void RecordTick(const Match& match);
+    // Call after changing the match outside of a tick, e.g. Match::Eliminate
+    void RecordEvent(const Match& match);
+    void Close(GameResult result = GameResult{});
+
+    bool IsOpen() const { return file != nullptr; }
+
+private:
+    void writeChunk(ReplayChunkType type, uint16_t flags, uint64_t tick, const void* payload, size_t size, const void* extra = nullptr, size_t extraSize = 0);
+    void writeKeyframe(const Match& match, uint16_t flags);
+    void flushInputs();
+
+    std::FILE* file = nullptr;
+    uint64_t offset = 0;
+    uint64_t tick = 0;
+    uint32_t keyframeInterval = defaultKeyframeInterval;
+    size_t playerCount = 0;
+    size_t stride = 0;
+    std::vector<uint8_t> inputs;
+    uint32_t bufferedTicks = 0;
+    std::vector<uint64_t> chunkOffsets;
+    std::vector<uint8_t> stateBuffer;
+};
+
+// Plays a recording back into a Match, headless or under the renderer
+class ReplayReader {
+public:
+    ReplayReader() = default;
+    ~ReplayReader() { Close(); }
+    ReplayReader(const ReplayReader&) = delete;
+    ReplayReader& operator=(const ReplayReader&) = delete;
+
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const { return data != nullptr; }
+
+    const ReplayHeader& GetHeader() const { return *reinterpret_cast<const ReplayHeader*>(data); }
+    uint64_t GetTickCount() const { return tickCount; }
+    // Result stored on Close, no winner for a recording without an index
+    GameResult GetResult() const { return result; }
+    // False for a recording cut short, it has no index and no result
+    bool IsComplete() const { return complete; }
+    // Ticks of the playback run so far
+    uint64_t GetTick() const { return tick; }
+
+    // Puts the match in the state it had right before tick ran, with the
+    // directions of that tick already set. Starts from the nearest keyframe
+    // and resizes the match to the recording.
+    bool Seek(Match& match, uint64_t tick);
+    // Runs the next recorded tick, returns false at the end
+    bool Step(Match& match);
+
+private:
+    struct InputBlock {
+        uint64_t firstTick;
+        uint32_t tickCount;
+        const uint8_t* rows;
+    };
+    struct Keyframe {
+        uint64_t tick;
+        bool event;
+        const uint8_t* state;
+        uint32_t size;
+    };
+
+    bool readIndex();
+    bool scanChunks();
+    bool addChunk(uint64_t chunkOffset);
+    bool applyInputs(Match& match);
+    void applyEvents(Match& match);
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+    std::vector<InputBlock> blocks;
+    std::vector<Keyframe> keyframes;
+    size_t stride = 0;
+    uint64_t tickCount = 0;
+    GameResult result;
+    bool complete = false;
+
+    uint64_t tick = 0;
+    size_t blockCursor = 0;
+    size_t keyframeCursor = 0;
+};
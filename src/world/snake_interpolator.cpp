@@ -0,0 +1,133 @@
+#include "snake_interpolator.h"
+#include <algorithm>
+#include <cmath>
+
+SnakeInterpolator::SnakeInterpolator(std::chrono::nanoseconds interval) :
+    interval(interval)
+{
+}
+
+void SnakeInterpolator::Clear()
+{
+    count = 0;
+}
+
+void SnakeInterpolator::Push(const Match& match, Clock::time_point time)
+{
+    if (count > 0) {
+        // Smoothed like the interarrival jitter of RFC 3550
+        double spacing = static_cast<double>((time - at(0).time).count());
+        double deviation = std::abs(spacing - static_cast<double>(interval.count()));
+        jitterNs += (deviation - jitterNs) / 16.0;
+    }
+    newest = (newest + 1) % capacity;
+    count = std::min(count + 1, capacity);
+
+    State& state = states[newest];
+    state.time = time;
+    state.gridSize = match.GetGridSize();
+    state.cells.clear();
+    state.offsets.clear();
+    const SnakeTable& snakes = match.GetSnakes();
+    for (size_t i = 0; i < snakes.Count(); ++i) {
+        state.offsets.push_back(state.cells.size());
+        BodyView body = snakes.GetBody(i);
+        size_t start = state.cells.size();
+        state.cells.resize(start + body.size());
+        body.CopyTo(state.cells.data() + start);
+    }
+    state.offsets.push_back(state.cells.size());
+}
+
+std::chrono::nanoseconds SnakeInterpolator::GetDelay() const
+{
+    // Two intervals at most, older states are not kept
+    auto margin = std::chrono::nanoseconds(static_cast<int64_t>(2.0 * jitterNs));
+    return interval + std::min(margin, interval);
+}
+
+void SnakeInterpolator::Sample(Clock::time_point now, InterpolatedSnakes& out) const
+{
+    if (count == 0) {
+        SampleLatest(out);
+        return;
+    }
+    Clock::time_point shown = now - GetDelay();
+    size_t age = count - 1;
+    if (at(age).time > shown) {
+        copy(at(age), out);
+        return;
+    }
+    // The newest state that is due, blended towards the one after it
+    while (age > 0 && at(age - 1).time <= shown) --age;
+    if (age == 0) {
+        copy(at(0), out);
+        return;
+    }
+    const State& from = at(age);
+    const State& to = at(age - 1);
+    auto span = to.time - from.time;
+    float alpha = span.count() > 0 ? static_cast<float>(static_cast<double>((shown - from.time).count()) / static_cast<double>(span.count())) : 1.0f;
+    blend(from, to, alpha, out);
+}
+
+void SnakeInterpolator::SampleLatest(InterpolatedSnakes& out) const
+{
+    if (count == 0) {
+        out.cells.clear();
+        out.offsets.assign(1, 0);
+        return;
+    }
+    copy(at(0), out);
+}
+
+void SnakeInterpolator::copy(const State& state, InterpolatedSnakes& out)
+{
+    out.cells.resize(state.cells.size());
+    for (size_t i = 0; i < state.cells.size(); ++i) {
+        out.cells[i] = RenderPos{ static_cast<float>(state.cells[i].x), static_cast<float>(state.cells[i].z) };
+    }
+    out.offsets = state.offsets;
+}
+
+void SnakeInterpolator::blend(const State& from, const State& to, float alpha, InterpolatedSnakes& out)
+{
+    if (from.offsets.size() != to.offsets.size() || from.gridSize != to.gridSize) {
+        copy(to, out);
+        return;
+    }
+    const float sizeX = to.gridSize.x;
+    const float sizeZ = to.gridSize.z;
+    out.cells.resize(to.cells.size());
+    out.offsets = to.offsets;
+    for (size_t i = 0; i + 1 < to.offsets.size(); ++i) {
+        const pos* before = from.cells.data() + from.offsets[i];
+        size_t beforeLength = from.offsets[i + 1] - from.offsets[i];
+        for (size_t j = to.offsets[i]; j < to.offsets[i + 1]; ++j) {
+            const pos& target = to.cells[j];
+            size_t index = j - to.offsets[i];
+            // A cell added by growth comes out of the old tail
+            if (beforeLength == 0) {
+                out.cells[j] = RenderPos{ static_cast<float>(target.x), static_cast<float>(target.z) };
+                continue;
+            }
+            const pos& source = before[std::min(index, beforeLength - 1)];
+
+            // The short way round, a cell leaving one edge enters at the other
+            float dx = static_cast<float>(target.x) - source.x;
+            float dz = static_cast<float>(target.z) - source.z;
+            if (dx * 2.0f > sizeX) dx -= sizeX;
+            else if (dx * 2.0f < -sizeX) dx += sizeX;
+            if (dz * 2.0f > sizeZ) dz -= sizeZ;
+            else if (dz * 2.0f < -sizeZ) dz += sizeZ;
+
+            float x = source.x + dx * alpha;
+            float z = source.z + dz * alpha;
+            if (x < -0.5f) x += sizeX;
+            else if (x >= sizeX - 0.5f) x -= sizeX;
+            if (z < -0.5f) z += sizeZ;
+            else if (z >= sizeZ - 0.5f) z -= sizeZ;
+            out.cells[j] = RenderPos{ x, z };
+        }
+    }
+}
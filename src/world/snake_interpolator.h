@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "match.h"
+
+// A point on the board between cells, in cell units
+struct RenderPos
+{
+    float x;
+    float z;
+};
+
+// Body cells of every snake for one frame. Snake i runs from offsets[i] to
+// offsets[i + 1] in cells.
+struct InterpolatedSnakes
+{
+    std::vector<RenderPos> cells;
+    std::vector<size_t> offsets;
+};
+
+// Lets the renderer move snakes smoothly between ticks. Each state is
+// stamped with the time it became known and shown a delay later, blended
+// with the state before it. The delay is one tick interval plus twice the
+// measured jitter of the stamps, so a state arriving late usually does not
+// leave the snakes waiting.
+class SnakeInterpolator {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit SnakeInterpolator(std::chrono::nanoseconds interval);
+
+    // Forgets every state, e.g. when a match starts
+    void Clear();
+    // time is when the state was due, see TickScheduler::DueTime
+    void Push(const Match& match, Clock::time_point time = Clock::now());
+    void Sample(Clock::time_point now, InterpolatedSnakes& out) const;
+    // Shows the newest state as is
+    void SampleLatest(InterpolatedSnakes& out) const;
+
+    std::chrono::nanoseconds GetDelay() const;
+    std::chrono::nanoseconds GetJitter() const { return std::chrono::nanoseconds(static_cast<int64_t>(jitterNs)); }
+
+private:
+    // Enough states to cover the longest delay and the tick after it
+    static constexpr size_t capacity = 4;
+
+    struct State
+    {
+        Clock::time_point time;
+        pos gridSize;
+        std::vector<pos> cells;
+        std::vector<size_t> offsets;
+    };
+
+    const State& at(size_t age) const { return states[(newest + capacity - age) % capacity]; }
+    static void copy(const State& state, InterpolatedSnakes& out);
+    static void blend(const State& from, const State& to, float alpha, InterpolatedSnakes& out);
+
+    std::chrono::nanoseconds interval;
+    std::array<State, capacity> states;
+    size_t newest = 0;
+    size_t count = 0;
+    double jitterNs = 0.0;
+};